@@ -0,0 +1,356 @@
+//Description: Replays an animation through animate_handler.cpp on Linux, with the display and SD card emulated
+//(emulator.cpp). Prints what each frame put over the display bus and read off the card, and how long that
+//would take on the --bus, so encodings can be compared without a board. The screen can be dumped as PPM after
+//every frame and checked against the BMPs the animation was compressed from
+//
+//Build from the repository's folder:
+//  g++ -O2 -Wall -Wextra -I"ARF Emulator/include" -I"ARF Emulator" -Isrc "ARF Emulator/emulator.cpp" "ARF Emulator/arf_emulator.cpp" src/animate_handler.cpp -o arf_emulator
+//
+//Usage: arf_emulator [--sd-root dir] [--bus name] [--strobe-ns ns] [--ppm dir] [--expect setup.txt] [-v] first.bmp [files]
+//The first BMP is drawn the way draw_animation does, then each file in turn by its extension:
+//  .arf       display_arf
+//  .txt       a --dedup manifest or a playlist.txt: display_arf for each line
+//  .pak       open_arf_pack, then draw_pack_frame for every frame
+//  .akf       open_arf_container, then draw_container_frame for frames 1 to the last and then frame 0
+//  .agr       open_arf_graph, draw_graph_state(0), then transition_to_state for each of the others and back to 0
+//  .pal       load_arf_palette (nothing is drawn)
+//  .spr       open_sprite_archive (nothing is drawn)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include <SD.h>
+#include "emulator.h"
+#include "animate_handler.h"
+
+//the handler's globals for the open pack, container and graph
+extern uint16_t pack_num_frames;
+extern uint16_t container_num_frames;
+extern uint16_t graph_num_states;
+
+/**************************************************************************************************************
+ *                  Expected Frames
+ **************************************************************************************************************/
+//The frames of a setup file, in the order the animation shows them: the BMP lines (every other line, skipping
+//@ directives), played forward then back without the ends when the file has @pingpong like the compressor does
+char** read_expected_frames(const char* setup_file, int* num_frames_out) {
+    FILE* fp = fopen(setup_file, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Couldn't open setup file %s\n", setup_file);
+        return NULL;
+    }
+    int max_frames = 16;
+    int num_frames = 0;
+    char** frames = (char**)malloc(max_frames*sizeof(char*));
+    bool ping_pong = false;
+    int line_num = 0;
+    char* line = NULL;
+    size_t len_line = 0;
+    ssize_t read_line_chars;
+    while ((read_line_chars = getline(&line, &len_line, fp)) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '@') {
+            ping_pong = ping_pong || strcmp(line, "@pingpong") == 0;
+            continue;
+        }
+        if (line_num++ % 2 != 0)
+            continue;
+        if (num_frames >= max_frames) {
+            max_frames *= 2;
+            frames = (char**)realloc(frames, max_frames*sizeof(char*));
+        }
+        frames[num_frames++] = strdup(line);
+    }
+    free(line);
+    fclose(fp);
+    if (ping_pong && num_frames > 2) {
+        int num_forward = num_frames;
+        frames = (char**)realloc(frames, (2*num_forward-2)*sizeof(char*));
+        for (int frame = num_forward-2; frame > 0; frame--)
+            frames[num_frames++] = strdup(frames[frame]);
+    }
+    *num_frames_out = num_frames;
+    return frames;
+}
+
+void free_expected_frames(char** frames, int num_frames) {
+    for (int i = 0; i < num_frames; i++)
+        free(frames[i]);
+    free(frames);
+}
+/**************************************************************************************************************
+ *                  END Expected Frames
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  Replay
+ **************************************************************************************************************/
+struct replay {
+    const char* ppm_dir;
+    char** expected;    //NULL without --expect
+    int num_expected;
+    int num_frames;     //frames drawn, the first BMP is frame 0
+    int num_checked;    //frames there was a BMP to check against
+    int num_mismatched; //frames that didn't match their BMP
+    double total_ms;
+    double max_ms;
+    int max_frame;
+    struct emulator_counters frame_start;
+};
+
+void replay_start_frame(struct replay* replay) {
+    replay->frame_start = emulator_totals;
+}
+
+//prints what the frame cost, dumps the screen and checks it against expected_frame (the index into the
+//expected frames, -1 when there isn't one)
+void replay_end_frame(struct replay* replay, const char* name, int expected_frame) {
+    struct emulator_counters frame;
+    emulator_counters_diff(&emulator_totals, &replay->frame_start, &frame);
+    double frame_ms = emulator_counters_ms(&frame);
+    printf("frame %d %s: %.3f ms, %llu commands, %llu data bytes, %llu data words, %llu draw calls, "
+           "%llu SD reads, %llu SD bytes, %llu seeks",
+           replay->num_frames, name, frame_ms, (unsigned long long)frame.commands, (unsigned long long)frame.data_bytes,
+           (unsigned long long)frame.data_words, (unsigned long long)frame.draw_calls, (unsigned long long)frame.sd_reads,
+           (unsigned long long)frame.sd_bytes, (unsigned long long)frame.sd_seeks);
+    if (replay->expected && expected_frame >= 0) {
+        const char* bmp_file = replay->expected[expected_frame % replay->num_expected];
+        int32_t num_different = emulator_compare_bmp(bmp_file);
+        replay->num_checked++;
+        if (num_different == 0)
+            printf(", matches %s", bmp_file);
+        else {
+            printf(", %d pixels differ from %s", num_different, bmp_file);
+            replay->num_mismatched++;
+        }
+    }
+    printf("\n");
+    if (replay->ppm_dir) {
+        char ppm_file[512];
+        snprintf(ppm_file, sizeof(ppm_file), "%s/%03d.ppm", replay->ppm_dir, replay->num_frames);
+        emulator_write_ppm(ppm_file);
+    }
+    //the first BMP isn't part of the animation's timing
+    if (replay->num_frames > 0) {
+        replay->total_ms += frame_ms;
+        if (frame_ms > replay->max_ms) {
+            replay->max_ms = frame_ms;
+            replay->max_frame = replay->num_frames;
+        }
+    }
+    replay->num_frames++;
+}
+
+//display_arf for each name in a manifest or playlist, relative to its folder. Line endings can be \n or \r\n.
+//The names are all read before the first frame so reading them isn't part of any frame
+bool replay_list(struct replay* replay, const char* list_file, int* next_expected) {
+    File list = SD.open(list_file);
+    if (!list) {
+        fprintf(stderr, "Couldn't open %s on the SD card\n", list_file);
+        return false;
+    }
+    const char* last_slash = strrchr(list_file, '/');
+    int dir_len = last_slash ? last_slash-list_file+1 : 0;
+    int max_names = 16;
+    int num_names = 0;
+    char** arf_paths = (char**)malloc(max_names*sizeof(char*));
+    char name[256];
+    while (list.available()) {
+        int name_len = list.readBytesUntil('\n', name, sizeof(name)-1);
+        if (name_len > 0 && name[name_len-1] == '\r')
+            name_len--;
+        if (name_len == 0)
+            continue;
+        if (num_names >= max_names) {
+            max_names *= 2;
+            arf_paths = (char**)realloc(arf_paths, max_names*sizeof(char*));
+        }
+        arf_paths[num_names] = (char*)malloc(dir_len+name_len+1);
+        memcpy(arf_paths[num_names], list_file, dir_len);
+        memcpy(arf_paths[num_names]+dir_len, name, name_len);
+        arf_paths[num_names][dir_len+name_len] = '\0';
+        num_names++;
+    }
+    list.close();
+    for (int i = 0; i < num_names; i++) {
+        replay_start_frame(replay);
+        display_arf(arf_paths[i]);
+        replay_end_frame(replay, arf_paths[i]+dir_len, (*next_expected)++);
+        free(arf_paths[i]);
+    }
+    free(arf_paths);
+    return true;
+}
+
+bool replay_pack(struct replay* replay, const char* pack_file, int* next_expected) {
+    if (!open_arf_pack(pack_file))
+        return false;
+    for (uint16_t frame = 0; frame < pack_num_frames; frame++) {
+        char name[32];
+        snprintf(name, sizeof(name), "pack frame %u", frame);
+        replay_start_frame(replay);
+        if (!draw_pack_frame(frame))
+            return false;
+        replay_end_frame(replay, name, (*next_expected)++);
+    }
+    return true;
+}
+
+//The container's frame 0 is the first BMP, so it's played from frame 1 and ends back on frame 0. Each draw is
+//the next frame's delta, except frame 1: nothing of the container is on the screen yet, so it's keyframe 0 and a delta
+bool replay_container(struct replay* replay, const char* container_file) {
+    if (!open_arf_container(container_file))
+        return false;
+    for (uint16_t i = 1; i <= container_num_frames; i++) {
+        uint16_t frame = i % container_num_frames;
+        char name[32];
+        snprintf(name, sizeof(name), "container frame %u", frame);
+        replay_start_frame(replay);
+        if (!draw_container_frame(frame))
+            return false;
+        replay_end_frame(replay, name, frame);
+    }
+    return true;
+}
+
+//draws state 0's keyframe, then goes to each other state and back to state 0 with transition_to_state.
+//The states aren't in a setup file's order, so there's nothing to check them against
+bool replay_graph(struct replay* replay, const char* graph_file) {
+    if (!open_arf_graph(graph_file))
+        return false;
+    char name[32];
+    replay_start_frame(replay);
+    if (!draw_graph_state(0))
+        return false;
+    replay_end_frame(replay, "graph state 0", -1);
+    for (uint16_t state = 1; state < graph_num_states; state++) {
+        snprintf(name, sizeof(name), "graph state %u", state);
+        replay_start_frame(replay);
+        if (!transition_to_state(state))
+            return false;
+        replay_end_frame(replay, name, -1);
+        replay_start_frame(replay);
+        if (!transition_to_state(0))
+            return false;
+        replay_end_frame(replay, "graph state 0", -1);
+    }
+    return true;
+}
+/**************************************************************************************************************
+ *                  END Replay
+ **************************************************************************************************************/
+
+const char* extract_extension(const char* file_name) {
+    const char* dot = strrchr(file_name, '.');
+    const char* slash = strrchr(file_name, '/');
+    return (dot && (!slash || dot > slash)) ? dot : "";
+}
+
+int main(int argc, char** argv) {
+    const char* usage = "Usage: %s [--sd-root dir] [--bus name] [--strobe-ns ns] [--ppm dir] [--expect setup.txt] [-v] first.bmp [files]\n";
+    const char* sd_root = ".";
+    struct bus_timing bus = bus_timings[0];
+    int strobe_ns = 0; //0 keeps the bus's own
+    const char* expect_file = NULL;
+    bool serial_echo = false;
+    struct replay replay;
+    memset(&replay, 0, sizeof(replay));
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        bool has_value = arg+1 < argc;
+        if (strcmp(argv[arg], "--sd-root") == 0 && has_value)
+            sd_root = argv[++arg];
+        else if (strcmp(argv[arg], "--bus") == 0 && has_value) {
+            const struct bus_timing* timing = find_bus_timing(argv[++arg]);
+            if (timing == NULL) {
+                fprintf(stderr, "Unknown bus %s, it can be:", argv[arg]);
+                for (int i = 0; i < num_bus_timings; i++)
+                    fprintf(stderr, " %s", bus_timings[i].name);
+                fprintf(stderr, "\n");
+                return 1;
+            }
+            bus = *timing;
+        }
+        else if (strcmp(argv[arg], "--strobe-ns") == 0 && has_value) {
+            strobe_ns = atoi(argv[++arg]);
+            if (strobe_ns <= 0) {
+                fprintf(stderr, "--strobe-ns needs a number of nanoseconds above 0\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[arg], "--ppm") == 0 && has_value)
+            replay.ppm_dir = argv[++arg];
+        else if (strcmp(argv[arg], "--expect") == 0 && has_value)
+            expect_file = argv[++arg];
+        else if (strcmp(argv[arg], "-v") == 0)
+            serial_echo = true;
+        else {
+            fprintf(stderr, usage, argv[0]);
+            return 1;
+        }
+    }
+    if (arg >= argc) {
+        fprintf(stderr, usage, argv[0]);
+        return 1;
+    }
+    if (strobe_ns > 0)
+        bus.strobe_ns = strobe_ns;
+    if (expect_file) {
+        replay.expected = read_expected_frames(expect_file, &replay.num_expected);
+        if (replay.expected == NULL)
+            return 1;
+        if (replay.num_expected == 0) {
+            fprintf(stderr, "Setup file %s has no frames\n", expect_file);
+            free(replay.expected);
+            return 1;
+        }
+    }
+    emulator_init(sd_root, &bus, serial_echo);
+    printf("Bus %s: %d ns a strobe, %d a word, %d ns a draw call, %d ns an SD read, %d ns an SD byte\n",
+           bus.name, bus.strobe_ns, bus.strobes_per_word, bus.call_ns, bus.sd_read_ns, bus.sd_byte_ns);
+
+    init_SD_display();
+    replay_start_frame(&replay);
+    display_bmp(argv[arg], down2up);
+    replay_end_frame(&replay, argv[arg], 0);
+    int next_expected = 1;
+    bool replayed = true;
+    for (arg++; arg < argc && replayed; arg++) {
+        const char* ext = extract_extension(argv[arg]);
+        if (strcmp(ext, ".arf") == 0) {
+            replay_start_frame(&replay);
+            display_arf(argv[arg]);
+            replay_end_frame(&replay, argv[arg], next_expected++);
+        }
+        else if (strcmp(ext, ".txt") == 0)
+            replayed = replay_list(&replay, argv[arg], &next_expected);
+        else if (strcmp(ext, ".pak") == 0)
+            replayed = replay_pack(&replay, argv[arg], &next_expected);
+        else if (strcmp(ext, ".akf") == 0)
+            replayed = replay_container(&replay, argv[arg]);
+        else if (strcmp(ext, ".agr") == 0)
+            replayed = replay_graph(&replay, argv[arg]);
+        else if (strcmp(ext, ".pal") == 0)
+            replayed = load_arf_palette(argv[arg]);
+        else if (strcmp(ext, ".spr") == 0)
+            replayed = open_sprite_archive(argv[arg]);
+        else {
+            fprintf(stderr, "Don't know how to play %s\n", argv[arg]);
+            replayed = false;
+        }
+        if (!replayed)
+            fprintf(stderr, "Replaying %s failed\n", argv[arg]);
+    }
+
+    if (replay.num_frames > 1) {
+        printf("%d frames after the BMP: %.3f ms in all, %.3f ms a frame, slowest frame %d at %.3f ms\n",
+               replay.num_frames-1, replay.total_ms, replay.total_ms/(replay.num_frames-1), replay.max_frame, replay.max_ms);
+    }
+    if (replay.expected) {
+        printf("%d of %d frames matched their BMP\n", replay.num_checked-replay.num_mismatched, replay.num_checked);
+        free_expected_frames(replay.expected, replay.num_expected);
+    }
+    return (replayed && replay.num_mismatched == 0) ? 0 : 1;
+}
@@ -0,0 +1,684 @@
+//Description: Host side stand-ins for what animate_handler.cpp runs on: the Arduino core, the SD library and
+//LCDWIKI_KBV driving an ILI9486. The display is an emulated controller with a 320x480 RGB565 framebuffer. Every
+//command, data write, draw call and SD card read is counted so the time a frame takes on a board can be estimated
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "emulator.h"
+#include <Arduino.h>
+#include <SD.h>
+#include <LCDWIKI_GUI.h>
+#include <LCDWIKI_KBV.h>
+
+/**************************************************************************************************************
+ *                  Bus Timings
+ **************************************************************************************************************/
+const struct bus_timing bus_timings[] = {
+    //name       strobe  per word  call   sd read  sd byte
+    {"mega16",   250,    1,        3000,  6000,    900}, //Arduino Mega with the 16 bit breakout (PORTA/PORTC)
+    {"shield8",  375,    2,        3000,  6000,    900}, //Arduino Mega/Uno with the 8 bit shield
+    {"sam3x",    120,    1,        600,   1500,    150}, //Arduino Due, 16 bit, bits shuffled across the PIO ports
+};
+const int num_bus_timings = (int)(sizeof(bus_timings)/sizeof(bus_timings[0]));
+
+const struct bus_timing* find_bus_timing(const char* name) {
+    for (int i = 0; i < num_bus_timings; i++) {
+        if (strcmp(bus_timings[i].name, name) == 0)
+            return &bus_timings[i];
+    }
+    return NULL;
+}
+
+struct emulator_counters emulator_totals;
+struct bus_timing emulator_bus = bus_timings[0];
+const char* emulator_sd_root = ".";
+bool emulator_serial_echo = false;
+unsigned long emulator_delay_ms = 0;
+
+void emulator_init(const char* sd_root, const struct bus_timing* timing, bool serial_echo) {
+    emulator_sd_root = sd_root;
+    emulator_bus = *timing;
+    emulator_serial_echo = serial_echo;
+}
+
+void emulator_counters_diff(const struct emulator_counters* after, const struct emulator_counters* before,
+                            struct emulator_counters* diff) {
+    diff->commands = after->commands - before->commands;
+    diff->wide_commands = after->wide_commands - before->wide_commands;
+    diff->data_bytes = after->data_bytes - before->data_bytes;
+    diff->data_words = after->data_words - before->data_words;
+    diff->pixels_written = after->pixels_written - before->pixels_written;
+    diff->draw_calls = after->draw_calls - before->draw_calls;
+    diff->sd_opens = after->sd_opens - before->sd_opens;
+    diff->sd_reads = after->sd_reads - before->sd_reads;
+    diff->sd_bytes = after->sd_bytes - before->sd_bytes;
+    diff->sd_seeks = after->sd_seeks - before->sd_seeks;
+}
+
+//A writeCmd8 and a writeData8 are one strobe, a writeCmd16 and a writeData16 are a word (two strobes on an 8 bit bus)
+uint64_t emulator_counters_strobes(const struct emulator_counters* counters) {
+    uint64_t words = counters->wide_commands + counters->data_words;
+    return counters->commands - counters->wide_commands + counters->data_bytes + words*emulator_bus.strobes_per_word;
+}
+
+//Seeks aren't timed: on the card they only cost when the next read has to load another sector, which the read
+//and byte costs already stand in for
+double emulator_counters_ms(const struct emulator_counters* counters) {
+    double ns = (double)emulator_counters_strobes(counters)*emulator_bus.strobe_ns
+              + (double)counters->draw_calls*emulator_bus.call_ns
+              + (double)counters->sd_reads*emulator_bus.sd_read_ns
+              + (double)counters->sd_bytes*emulator_bus.sd_byte_ns;
+    return ns/1000000.0;
+}
+/**************************************************************************************************************
+ *                  END Bus Timings
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  ILI9486 Controller
+ **************************************************************************************************************/
+#define ili9486_caset 0x2A //column address set: start16, end16 as 4 data bytes
+#define ili9486_paset 0x2B //page address set: start16, end16 as 4 data bytes
+#define ili9486_ramwr 0x2C //memory write: the pixels from the window's start
+#define ili9486_ramwrc 0x3C //memory write continue: the pixels from where the last write stopped
+
+uint16_t framebuffer[emulator_width*emulator_height];
+
+//The controller's side of the bus: the command being run, its parameters so far and the memory write pointer,
+//which goes along the window's columns and wraps to the next page (row), then back to the window's start
+struct ili9486_state {
+    uint16_t cmd;
+    int num_params;
+    uint8_t params[4];
+    uint16_t column_start, column_end;
+    uint16_t page_start, page_end;
+    uint16_t column, page;
+};
+
+struct ili9486_state controller = {0, 0, {0, 0, 0, 0}, 0, emulator_width-1, 0, emulator_height-1, 0, 0};
+
+void bus_command(uint16_t cmd, bool wide) {
+    emulator_totals.commands++;
+    if (wide)
+      emulator_totals.wide_commands++;
+    controller.cmd = cmd & 0xFF;
+    controller.num_params = 0;
+    if (controller.cmd == ili9486_ramwr) {
+      controller.column = controller.column_start;
+      controller.page = controller.page_start;
+    }
+}
+
+void bus_param(uint8_t data) {
+    if (controller.num_params >= 4)
+      return;
+    controller.params[controller.num_params++] = data;
+    if (controller.num_params < 4)
+      return;
+    uint16_t start = (controller.params[0] << 8) | controller.params[1];
+    uint16_t end = (controller.params[2] << 8) | controller.params[3];
+    if (controller.cmd == ili9486_caset) {
+      controller.column_start = start;
+      controller.column_end = end;
+    }
+    else {
+      controller.page_start = start;
+      controller.page_end = end;
+    }
+}
+
+void bus_data8(uint8_t data) {
+    emulator_totals.data_bytes++;
+    if (controller.cmd == ili9486_caset || controller.cmd == ili9486_paset)
+      bus_param(data);
+}
+
+//a pixel outside the screen (a window past the edge) is dropped, but it still moves the write pointer
+void bus_data16(uint16_t data) {
+    emulator_totals.data_words++;
+    if (controller.cmd == ili9486_caset || controller.cmd == ili9486_paset) {
+      bus_param(data >> 8);
+      bus_param(data & 0xFF);
+      return;
+    }
+    if (controller.cmd != ili9486_ramwr && controller.cmd != ili9486_ramwrc)
+      return;
+    if (controller.column < emulator_width && controller.page < emulator_height) {
+      framebuffer[(uint32_t)controller.page*emulator_width + controller.column] = data;
+      emulator_totals.pixels_written++;
+    }
+    if (controller.column >= controller.column_end) {
+      controller.column = controller.column_start;
+      controller.page = controller.page >= controller.page_end ? controller.page_start : controller.page+1;
+    }
+    else
+      controller.column++;
+}
+
+void count_draw_call() {
+    emulator_totals.draw_calls++;
+}
+
+const uint16_t* emulator_framebuffer() {
+    return framebuffer;
+}
+/**************************************************************************************************************
+ *                  END ILI9486 Controller
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  Arduino Core
+ **************************************************************************************************************/
+HardwareSerial Serial;
+
+//the board's clock is what the player has cost so far, so the handler's own timings are estimates too
+unsigned long millis() {
+    return (unsigned long)emulator_counters_ms(&emulator_totals) + emulator_delay_ms;
+}
+
+void delay(unsigned long ms) {
+    emulator_delay_ms += ms;
+}
+
+void pinMode(uint8_t, uint8_t) {
+}
+
+void HardwareSerial::print(const char* str) {
+    if (emulator_serial_echo)
+      printf("%s", str);
+}
+void HardwareSerial::print(char c) {
+    if (emulator_serial_echo)
+      printf("%c", c);
+}
+void HardwareSerial::print(int value) {
+    if (emulator_serial_echo)
+      printf("%d", value);
+}
+void HardwareSerial::print(unsigned int value) {
+    if (emulator_serial_echo)
+      printf("%u", value);
+}
+void HardwareSerial::print(long value) {
+    if (emulator_serial_echo)
+      printf("%ld", value);
+}
+void HardwareSerial::print(unsigned long value) {
+    if (emulator_serial_echo)
+      printf("%lu", value);
+}
+void HardwareSerial::println() {
+    print("\n");
+}
+void HardwareSerial::println(const char* str) {
+    print(str);
+    println();
+}
+void HardwareSerial::println(char c) {
+    print(c);
+    println();
+}
+void HardwareSerial::println(int value) {
+    print(value);
+    println();
+}
+void HardwareSerial::println(unsigned int value) {
+    print(value);
+    println();
+}
+void HardwareSerial::println(long value) {
+    print(value);
+    println();
+}
+void HardwareSerial::println(unsigned long value) {
+    print(value);
+    println();
+}
+/**************************************************************************************************************
+ *                  END Arduino Core
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  SD Card
+ **************************************************************************************************************/
+SDClass SD;
+
+File::File() : state(NULL) {
+}
+
+File::File(struct sd_file_state* state) : state(state) {
+}
+
+File::File(const File& other) : state(other.state) {
+    if (state)
+      state->num_refs++;
+}
+
+File& File::operator=(const File& other) {
+    if (other.state)
+      other.state->num_refs++;
+    release();
+    state = other.state;
+    return *this;
+}
+
+File::~File() {
+    release();
+}
+
+void File::release() {
+    if (state && --state->num_refs == 0) {
+      if (state->fp)
+        fclose(state->fp);
+      free(state);
+    }
+    state = NULL;
+}
+
+int File::read() {
+    if (!state || !state->fp)
+      return -1;
+    emulator_totals.sd_reads++;
+    int c = fgetc(state->fp);
+    if (c != EOF)
+      emulator_totals.sd_bytes++;
+    return c == EOF ? -1 : c;
+}
+
+int File::read(void* buf, uint16_t nbyte) {
+    if (!state || !state->fp)
+      return -1;
+    emulator_totals.sd_reads++;
+    size_t num_read = fread(buf, 1, nbyte, state->fp);
+    emulator_totals.sd_bytes += num_read;
+    return (int)num_read;
+}
+
+int File::peek() {
+    if (!state || !state->fp)
+      return -1;
+    int c = fgetc(state->fp);
+    if (c != EOF)
+      ungetc(c, state->fp);
+    return c == EOF ? -1 : c;
+}
+
+int File::available() {
+    if (!state || !state->fp)
+      return 0;
+    uint32_t pos = position();
+    return pos < state->size ? (int)(state->size - pos) : 0;
+}
+
+bool File::seek(uint32_t pos) {
+    if (!state || !state->fp || pos > state->size)
+      return false;
+    emulator_totals.sd_seeks++;
+    return fseek(state->fp, pos, SEEK_SET) == 0;
+}
+
+uint32_t File::position() {
+    if (!state || !state->fp)
+      return 0;
+    return (uint32_t)ftell(state->fp);
+}
+
+uint32_t File::size() {
+    return state ? state->size : 0;
+}
+
+//Stream's readBytesUntil on the board reads a byte at a time, so it's counted that way
+size_t File::readBytesUntil(char terminator, char* buffer, size_t length) {
+    size_t num_read = 0;
+    while (num_read < length) {
+      int c = read();
+      if (c < 0 || c == terminator)
+        break;
+      buffer[num_read++] = (char)c;
+    }
+    return num_read;
+}
+
+//closes it for every copy, like the SdFile they share on the board
+void File::close() {
+    if (state && state->fp) {
+      fclose(state->fp);
+      state->fp = NULL;
+    }
+    release();
+}
+
+File::operator bool() {
+    return state && state->fp;
+}
+
+bool SDClass::begin(uint8_t) {
+    struct stat root_stat;
+    if (stat(emulator_sd_root, &root_stat) != 0 || !S_ISDIR(root_stat.st_mode)) {
+      fprintf(stderr, "SD card folder %s isn't there\n", emulator_sd_root);
+      return false;
+    }
+    return true;
+}
+
+//file_name is relative to the SD card folder, with or without a leading /
+File SDClass::open(const char* file_name, uint8_t) {
+    emulator_totals.sd_opens++;
+    while (*file_name == '/')
+      file_name++;
+    char* path = (char*)malloc(strlen(emulator_sd_root) + strlen(file_name) + 2);
+    sprintf(path, "%s/%s", emulator_sd_root, file_name);
+    struct stat file_stat;
+    FILE* fp = NULL;
+    if (stat(path, &file_stat) == 0 && S_ISREG(file_stat.st_mode))
+      fp = fopen(path, "rb");
+    free(path);
+    if (fp == NULL)
+      return File();
+    struct sd_file_state* state = (struct sd_file_state*)malloc(sizeof(struct sd_file_state));
+    state->fp = fp;
+    state->size = (uint32_t)file_stat.st_size;
+    state->num_refs = 1;
+    return File(state);
+}
+
+bool SDClass::exists(const char* file_name) {
+    File file = open(file_name);
+    emulator_totals.sd_opens--;
+    return (bool)file;
+}
+/**************************************************************************************************************
+ *                  END SD Card
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  LCDWIKI
+ **************************************************************************************************************/
+LCDWIKI_GUI::LCDWIKI_GUI() : draw_color(0), text_color(0), text_back_color(0), text_size(1) {
+}
+
+void LCDWIKI_GUI::Set_Draw_color(uint16_t color) {
+    draw_color = color;
+}
+
+void LCDWIKI_GUI::Set_Draw_color(uint8_t r, uint8_t g, uint8_t b) {
+    draw_color = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+}
+
+uint16_t LCDWIKI_GUI::Get_Draw_color() const {
+    return draw_color;
+}
+
+void LCDWIKI_GUI::Draw_Fast_HLine(int16_t x, int16_t y, int16_t w) {
+    Fill_Rect(x, y, w, 1, draw_color);
+}
+
+void LCDWIKI_GUI::Draw_Fast_VLine(int16_t x, int16_t y, int16_t h) {
+    Fill_Rect(x, y, 1, h, draw_color);
+}
+
+void LCDWIKI_GUI::Fill_Screen(uint16_t color) {
+    Fill_Rect(0, 0, Get_Width(), Get_Height(), color);
+}
+
+void LCDWIKI_GUI::Draw_Bit_Map(int16_t x, int16_t y, int16_t sx, int16_t sy, const uint16_t* data, int16_t scale) {
+    Set_Addr_Window(x, y, x + sx*scale - 1, y + sy*scale - 1);
+    if (scale == 1) {
+      Push_Any_Color((uint16_t*)data, sx*sy, 1, 0);
+      return;
+    }
+    for (int16_t row = 0; row < sy; row++) {
+      for (int16_t col = 0; col < sx; col++)
+        Fill_Rect(x + col*scale, y + row*scale, scale, scale, data[row*sx + col]);
+    }
+}
+
+int16_t LCDWIKI_GUI::Get_Display_Width() const {
+    return Get_Width();
+}
+
+int16_t LCDWIKI_GUI::Get_Display_Height() const {
+    return Get_Height();
+}
+
+void LCDWIKI_GUI::Set_Text_colour(uint16_t color) {
+    text_color = color;
+}
+
+void LCDWIKI_GUI::Set_Text_Back_colour(uint16_t color) {
+    text_back_color = color;
+}
+
+void LCDWIKI_GUI::Set_Text_Size(uint8_t size) {
+    text_size = size;
+}
+
+void LCDWIKI_GUI::Print_String(const char* str, int16_t x, int16_t y) {
+    fprintf(stderr, "LCD text at (%d, %d): %s\n", x, y, str);
+}
+
+//only the ILI9486 is emulated, a different model still draws as one
+LCDWIKI_KBV::LCDWIKI_KBV(uint16_t model, uint8_t, uint8_t, uint8_t, uint8_t, uint8_t)
+    : lcd_model(model), width(emulator_width), height(emulator_height) {
+}
+
+//The power on commands aren't sent or counted, the emulated controller starts out the way they leave it
+void LCDWIKI_KBV::Init_LCD() {
+    controller.cmd = 0;
+    controller.num_params = 0;
+    controller.column_start = 0;
+    controller.column_end = width-1;
+    controller.page_start = 0;
+    controller.page_end = height-1;
+}
+
+//Set_Addr_Window without the call: two Push_Command calls, a 16 bit command and 4 data bytes each
+void LCDWIKI_KBV::push_window(int16_t x1, int16_t y1, int16_t x2, int16_t y2) {
+    bus_command(ili9486_caset, true);
+    bus_data8(x1 >> 8);
+    bus_data8(x1 & 0xFF);
+    bus_data8(x2 >> 8);
+    bus_data8(x2 & 0xFF);
+    bus_command(ili9486_paset, true);
+    bus_data8(y1 >> 8);
+    bus_data8(y1 & 0xFF);
+    bus_data8(y2 >> 8);
+    bus_data8(y2 & 0xFF);
+}
+
+//the bounds check is the library's, which lets x == width and y == height through
+void LCDWIKI_KBV::Draw_Pixe(int16_t x, int16_t y, uint16_t color) {
+    count_draw_call();
+    if ((x < 0) || (y < 0) || (x > Get_Width()) || (y > Get_Height()))
+      return;
+    push_window(x, y, x, y);
+    bus_command(ili9486_ramwr, true);
+    bus_data16(color);
+}
+
+void LCDWIKI_KBV::Fill_Rect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) {
+    count_draw_call();
+    int16_t end;
+    if (w < 0) {
+      w = -w;
+      x -= w;
+    }
+    end = x + w;
+    if (x < 0)
+      x = 0;
+    if (end > Get_Width())
+      end = Get_Width();
+    w = end - x;
+    if (h < 0) {
+      h = -h;
+      y -= h;
+    }
+    end = y + h;
+    if (y < 0)
+      y = 0;
+    if (end > Get_Height())
+      end = Get_Height();
+    h = end - y;
+    push_window(x, y, x + w - 1, y + h - 1);
+    bus_command(ili9486_ramwr, false);
+    if (w <= 0 || h <= 0)
+      return;
+    for (int32_t pixel = (int32_t)w*h; pixel > 0; pixel--)
+      bus_data16(color);
+}
+
+void LCDWIKI_KBV::Set_Addr_Window(int16_t x1, int16_t y1, int16_t x2, int16_t y2) {
+    count_draw_call();
+    push_window(x1, y1, x2, y2);
+}
+
+void LCDWIKI_KBV::Push_Any_Color(uint16_t* block, int16_t n, bool first, uint8_t flags) {
+    count_draw_call();
+    bool isconst = flags & 1;
+    if (first)
+      bus_command(ili9486_ramwr, false);
+    while (n-- > 0) {
+      bus_data16(isconst ? pgm_read_word(block) : *block);
+      block++;
+    }
+}
+
+//the colors are two bytes each, little endian unless flags has 2 set
+void LCDWIKI_KBV::Push_Any_Color(uint8_t* block, int16_t n, bool first, uint8_t flags) {
+    count_draw_call();
+    bool isbigend = (flags & 2) != 0;
+    if (first)
+      bus_command(ili9486_ramwr, false);
+    while (n-- > 0) {
+      uint8_t l = *block++;
+      uint8_t h = *block++;
+      bus_data16(isbigend ? (l << 8) | h : (h << 8) | l);
+    }
+}
+
+//encode 6's words: a tag, then what it says comes after. stream_state carries a tag split between chunks
+void LCDWIKI_KBV::Push_Bus_Stream(uint16_t* block, int16_t n, uint16_t* stream_state) {
+    count_draw_call();
+    uint16_t tag = stream_state[0];
+    uint16_t left = stream_state[1];
+    while (n-- > 0) {
+      uint16_t word = *block++;
+      if (left == 0) {
+        tag = word;
+        if (tag & 0x8000) {
+          bus_command(tag & 0xFF, true);
+          left = (tag & 0x4000) ? 2 : 0;
+        }
+        else
+          left = (tag & 0x4000) ? 1 : tag;
+      }
+      else if (tag & 0x8000) {
+        bus_data8(word >> 8);
+        bus_data8(word & 0xFF);
+        left--;
+      }
+      else if (tag & 0x4000) {
+        for (uint16_t count = tag & 0x3FFF; count > 0; count--)
+          bus_data16(word);
+        left = 0;
+      }
+      else {
+        bus_data16(word);
+        left--;
+      }
+    }
+    stream_state[0] = tag;
+    stream_state[1] = left;
+}
+
+int16_t LCDWIKI_KBV::Get_Height() const {
+    return height;
+}
+
+int16_t LCDWIKI_KBV::Get_Width() const {
+    return width;
+}
+/**************************************************************************************************************
+ *                  END LCDWIKI
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  Screen Output
+ **************************************************************************************************************/
+//RGB565 to 8 bits a channel, the top bits are copied into the bottom so white stays white
+bool emulator_write_ppm(const char* ppm_file) {
+    FILE* fp = fopen(ppm_file, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Couldn't write %s\n", ppm_file);
+        return false;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", emulator_width, emulator_height);
+    uint8_t row[emulator_width*3];
+    for (int y = 0; y < emulator_height; y++) {
+        for (int x = 0; x < emulator_width; x++) {
+            uint16_t color = framebuffer[y*emulator_width + x];
+            uint8_t r = (color >> 11) & 0x1F, g = (color >> 5) & 0x3F, b = color & 0x1F;
+            row[x*3] = (r << 3) | (r >> 2);
+            row[x*3+1] = (g << 2) | (g >> 4);
+            row[x*3+2] = (b << 3) | (b >> 2);
+        }
+        fwrite(row, 1, sizeof(row), fp);
+    }
+    bool written = ferror(fp) == 0;
+    fclose(fp);
+    return written;
+}
+
+//display_bmp (down2up) puts line i of the pixel array on screen row i. A 480 wide BMP is drawn as columns
+//instead, line i going down screen column i
+int32_t emulator_compare_bmp(const char* bmp_file) {
+    FILE* fp = fopen(bmp_file, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Couldn't open %s\n", bmp_file);
+        return -1;
+    }
+    uint8_t header[34];
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) || header[0] != 'B' || header[1] != 'M') {
+        fprintf(stderr, "%s isn't a BMP\n", bmp_file);
+        fclose(fp);
+        return -1;
+    }
+    uint32_t offset, compression;
+    int32_t width, height;
+    uint16_t bits;
+    memcpy(&offset, header+10, 4);
+    memcpy(&width, header+18, 4);
+    memcpy(&height, header+22, 4);
+    memcpy(&bits, header+28, 2);
+    memcpy(&compression, header+30, 4);
+    bool portrait = width == emulator_width && height == emulator_height;
+    bool landscape = width == emulator_height && height == emulator_width;
+    if (bits != 16 || compression != 3 || !(portrait || landscape)) {
+        fprintf(stderr, "%s isn't a 320x480 RGB565 BMP\n", bmp_file);
+        fclose(fp);
+        return -1;
+    }
+    uint16_t line[emulator_height];
+    int32_t num_different = 0;
+    fseek(fp, offset, SEEK_SET);
+    for (int line_num = 0; line_num < height; line_num++) {
+        if (fread(line, sizeof(uint16_t), width, fp) != (size_t)width) {
+            fprintf(stderr, "%s is cut short\n", bmp_file);
+            fclose(fp);
+            return -1;
+        }
+        for (int pixel_num = 0; pixel_num < width; pixel_num++) {
+            uint32_t screen_pos = portrait ? line_num*emulator_width + pixel_num : pixel_num*emulator_width + line_num;
+            if (framebuffer[screen_pos] != line[pixel_num])
+                num_different++;
+        }
+    }
+    fclose(fp);
+    return num_different;
+}
+/**************************************************************************************************************
+ *                  END Screen Output
+ **************************************************************************************************************/
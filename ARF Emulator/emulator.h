@@ -0,0 +1,75 @@
+//Host side ILI9486 emulator. The stand-in Arduino, SD and LCDWIKI headers in include/ let animate_handler.cpp
+//build for Linux unchanged: the display is a 320x480 RGB565 framebuffer behind an emulated controller, the SD card
+//is a folder, and everything that goes over the display bus or comes off the card is counted so a frame's draw
+//time can be estimated for a board
+#ifndef ARF_EMULATOR_H
+#define ARF_EMULATOR_H
+
+#include <stdint.h>
+
+#define emulator_width 320
+#define emulator_height 480
+
+//Rough timings of the board, the same as the bus_models table in animate_compress.cpp so the emulator's
+//estimates agree with what encode 4 and 6 were planned for. Keep the two tables in step
+struct bus_timing {
+    const char* name;
+    int strobe_ns;        //one write strobe on the display bus
+    int strobes_per_word; //strobes to put out 16 bits: 1 on a 16 bit bus, 2 on an 8 bit bus
+    int call_ns;          //overhead of one LCDWIKI_KBV draw call (chip select, clipping, the call itself)
+    int sd_read_ns;       //overhead of one File.read call
+    int sd_byte_ns;       //each byte read from the SD card
+};
+
+extern const struct bus_timing bus_timings[];
+extern const int num_bus_timings;
+
+//Finds the bus timing called name. Returns NULL when there isn't one
+const struct bus_timing* find_bus_timing(const char* name);
+
+//What the player has done since the emulator started. Take a copy before and after a frame and subtract
+struct emulator_counters {
+    uint64_t commands;       //command writes, wide_commands of them 16 bit (writeCmd16)
+    uint64_t wide_commands;
+    uint64_t data_bytes;     //writeData8, the address window's parameters
+    uint64_t data_words;     //writeData16, the pixels
+    uint64_t pixels_written; //data words that landed on the screen
+    uint64_t draw_calls;     //LCDWIKI_KBV calls the handler made
+    uint64_t sd_opens;
+    uint64_t sd_reads;       //File.read calls (the 1 byte read() too)
+    uint64_t sd_bytes;
+    uint64_t sd_seeks;
+};
+
+extern struct emulator_counters emulator_totals;
+
+//sets up the SD card folder and the board the time is estimated for. With serial_echo the handler's Serial
+//output goes to stdout
+void emulator_init(const char* sd_root, const struct bus_timing* timing, bool serial_echo);
+
+void emulator_counters_diff(const struct emulator_counters* after, const struct emulator_counters* before,
+                            struct emulator_counters* diff);
+
+//the bus strobes the counters add up to on the emulator's bus
+uint64_t emulator_counters_strobes(const struct emulator_counters* counters);
+
+//the estimated time, in milliseconds, the counters took on the emulator's bus
+double emulator_counters_ms(const struct emulator_counters* counters);
+
+//the screen, row by row from the top
+const uint16_t* emulator_framebuffer();
+
+//writes the screen as a binary (P6) PPM
+bool emulator_write_ppm(const char* ppm_file);
+
+//compares the screen with a 16 bit RGB565 BMP as the handler's display_bmp draws it (down2up). Returns the
+//number of pixels that differ, or -1 when the BMP can't be read
+int32_t emulator_compare_bmp(const char* bmp_file);
+
+//what the controller is given on the bus, LCDWIKI_KBV.h's class puts everything through these
+void bus_command(uint16_t cmd, bool wide);
+void bus_data8(uint8_t data);
+void bus_data16(uint16_t data);
+void count_draw_call();
+
+#endif
@@ -0,0 +1,43 @@
+//Stand-in for the Arduino core, just what animate_handler.cpp uses. millis() is the emulated board's clock,
+//so the handler's draw times come out as the emulator's estimates
+#ifndef ARF_EMULATOR_ARDUINO_H
+#define ARF_EMULATOR_ARDUINO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+
+unsigned long millis();
+void delay(unsigned long ms);
+void pinMode(uint8_t pin, uint8_t mode);
+
+//Serial goes to stdout with -v, otherwise it's dropped
+class HardwareSerial {
+  public:
+    void print(const char* str);
+    void print(char c);
+    void print(int value);
+    void print(unsigned int value);
+    void print(long value);
+    void print(unsigned long value);
+    void println();
+    void println(const char* str);
+    void println(char c);
+    void println(int value);
+    void println(unsigned int value);
+    void println(long value);
+    void println(unsigned long value);
+};
+
+extern HardwareSerial Serial;
+
+#endif
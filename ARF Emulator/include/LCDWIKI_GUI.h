@@ -0,0 +1,43 @@
+//Stand-in for the LCDWIKI_GUI library. Like the real one, the lines, fills and bitmaps are built out of the
+//driver's Fill_Rect, Set_Addr_Window and Push_Any_Color, so they cost what they cost on the board
+#ifndef ARF_EMULATOR_LCDWIKI_GUI_H
+#define ARF_EMULATOR_LCDWIKI_GUI_H
+
+#include <Arduino.h>
+
+class LCDWIKI_GUI {
+  public:
+    LCDWIKI_GUI();
+    virtual ~LCDWIKI_GUI() {}
+
+    void Set_Draw_color(uint16_t color);
+    void Set_Draw_color(uint8_t r, uint8_t g, uint8_t b);
+    uint16_t Get_Draw_color() const;
+    void Draw_Fast_HLine(int16_t x, int16_t y, int16_t w);
+    void Draw_Fast_VLine(int16_t x, int16_t y, int16_t h);
+    void Fill_Screen(uint16_t color);
+    void Draw_Bit_Map(int16_t x, int16_t y, int16_t sx, int16_t sy, const uint16_t* data, int16_t scale);
+    int16_t Get_Display_Width() const;
+    int16_t Get_Display_Height() const;
+
+    //text isn't drawn, it's echoed to stderr so a failing player still says why
+    void Set_Text_colour(uint16_t color);
+    void Set_Text_Back_colour(uint16_t color);
+    void Set_Text_Size(uint8_t size);
+    void Print_String(const char* str, int16_t x, int16_t y);
+
+    virtual void Draw_Pixe(int16_t x, int16_t y, uint16_t color) = 0;
+    virtual void Fill_Rect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) = 0;
+    virtual void Set_Addr_Window(int16_t x1, int16_t y1, int16_t x2, int16_t y2) = 0;
+    virtual void Push_Any_Color(uint16_t* block, int16_t n, bool first, uint8_t flags) = 0;
+    virtual int16_t Get_Height() const = 0;
+    virtual int16_t Get_Width() const = 0;
+
+  protected:
+    uint16_t draw_color;
+    uint16_t text_color;
+    uint16_t text_back_color;
+    uint8_t text_size;
+};
+
+#endif
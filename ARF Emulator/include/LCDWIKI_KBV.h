@@ -0,0 +1,33 @@
+//Stand-in for the LCDWIKI_KBV library, only the ILI9486 on a 16 bit bus. Each draw call puts out the same
+//commands and data as the real library's does, to the emulated controller in emulator.cpp
+#ifndef ARF_EMULATOR_LCDWIKI_KBV_H
+#define ARF_EMULATOR_LCDWIKI_KBV_H
+
+#include <Arduino.h>
+#include <LCDWIKI_GUI.h>
+
+#define ILI9486 6
+#define ID_9486 5
+
+class LCDWIKI_KBV : public LCDWIKI_GUI {
+  public:
+    LCDWIKI_KBV(uint16_t model, uint8_t cs, uint8_t cd, uint8_t wr, uint8_t rd, uint8_t reset);
+
+    void Init_LCD();
+    void Draw_Pixe(int16_t x, int16_t y, uint16_t color);
+    void Fill_Rect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+    void Set_Addr_Window(int16_t x1, int16_t y1, int16_t x2, int16_t y2);
+    void Push_Any_Color(uint16_t* block, int16_t n, bool first, uint8_t flags);
+    void Push_Any_Color(uint8_t* block, int16_t n, bool first, uint8_t flags);
+    void Push_Bus_Stream(uint16_t* block, int16_t n, uint16_t* stream_state);
+    int16_t Get_Height() const;
+    int16_t Get_Width() const;
+
+  private:
+    void push_window(int16_t x1, int16_t y1, int16_t x2, int16_t y2);
+    uint16_t lcd_model;
+    int16_t width;
+    int16_t height;
+};
+
+#endif
@@ -0,0 +1,49 @@
+//Stand-in for the Arduino SD library: the card is a folder (--sd-root) and every File is a FILE*. The handler
+//passes Files by value, so copies share one open file (and its position) the way they share the SdFile on the board
+#ifndef ARF_EMULATOR_SD_H
+#define ARF_EMULATOR_SD_H
+
+#include <Arduino.h>
+
+#define FILE_READ 0x01
+
+struct sd_file_state {
+    FILE* fp;
+    uint32_t size;
+    int num_refs;
+};
+
+class File {
+  public:
+    File();
+    File(struct sd_file_state* state);
+    File(const File& other);
+    File& operator=(const File& other);
+    ~File();
+
+    int read();
+    int read(void* buf, uint16_t nbyte);
+    int peek();
+    int available();
+    bool seek(uint32_t pos);
+    uint32_t position();
+    uint32_t size();
+    size_t readBytesUntil(char terminator, char* buffer, size_t length);
+    void close();
+    operator bool();
+
+  private:
+    void release();
+    struct sd_file_state* state;
+};
+
+class SDClass {
+  public:
+    bool begin(uint8_t cs_pin);
+    File open(const char* file_name, uint8_t mode = FILE_READ);
+    bool exists(const char* file_name);
+};
+
+extern SDClass SD;
+
+#endif
@@ -0,0 +1,7 @@
+//Stand-in for the Arduino SPI library. The emulated SD card doesn't need it
+#ifndef ARF_EMULATOR_SPI_H
+#define ARF_EMULATOR_SPI_H
+
+#include <Arduino.h>
+
+#endif
@@ -8,6 +8,15 @@
 //  Holds data in this form: [x_location16, y_location16, r5g6b5]. This way for all entries
 //Encode of 2:
 //  Holds data in this form: [y_location16, num_x_location_entries16, [r6g6b5, x_location_startN, x_location_endN]]
+//Encode of 3:
+//  Holds data in this form: [x0_16, y0_16, x1_16, y1_16, [r5g6b5 for every pixel in the rectangle, row by row]]
+//Encode of 4:
+//  Holds data in this form: [y_location16, num_ops16, [x_location_startN, lengthN, r5g6b5] or [x_location_startN, -lengthN, [r5g6b5 * lengthN]]]
+//Encode of 5:
+//  Holds data in this form: [sprite_num16, x_location16, y_location16] or [0, x_location16, y_location16, width16, height16] 
+//  to restore the background. The sprites are in sprites.spr
+//Encode of 6:
+//  Holds the display bus writes: [0x8000|cmd], [0xC000|cmd, start16, end16], [0x4000|count, r5g6b5] or [count, [r5g6b5 * count]]
 //Stores the data into .arf files (animation rendering format)
 
 //NOTES:
@@ -22,11 +31,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #define s_width 320
 #define s_height 480
@@ -45,7 +63,7 @@
 #define output_dir_argv 2
 
 //Output File Organization: 
-//     Encode Type: 1 and 2
+//     Encode Type: 1 through 6
 //     Extension: .arf
 #define offset2widthpos(offset) (int16_t)((offset) % s_width)
 #define offset2heightpos(offset) (int16_t)((offset) / s_width)
@@ -54,14 +72,44 @@
 //The macros for defining if we're on windows or linux. For file handling 
 #if defined(_WIN32) || defined(WIN32) || defined(__CYGWIN__) || defined(__MINGW32__) || defined(__BORLANDC__)
 #define slash_chr 0
+#define use_mmap_ingest 0 //no mmap, frames are read in with fread
+#define use_hard_links 0 //cached .arf files get copied
+#include <direct.h>
+#define make_dir(dir) _mkdir(dir)
 #else 
 #define slash_chr 1
+#define use_mmap_ingest 1 //frames are mapped and the pixel array points straight into the file
+#define use_hard_links 1 //cached .arf files get hard linked instead of copied
+#include <sys/mman.h>
+#define make_dir(dir) mkdir(dir, 0777)
 #endif
 
 //Testing Code:
-//gcc -Wall -Werror animate_compress.cpp -o animate_compress
+//gcc -Wall -Werror animate_compress.cpp -o animate_compress -lpthread
+//gcc -Wall -Werror -O2 -mavx2 animate_compress.cpp -o animate_compress -lpthread (AVX2 frame differencing)
+//animate_compress.exe "Output/test.txt" Output 2 -j 8 (encodes the frame pairs on 8 threads)
+//animate_compress.exe --batch "Output/batch.txt" 2 -j 8 (every animation in the batch file in one run)
+//animate_compress.exe "Output/test.txt" --bench-transpose 50 (times left/right encoding with and without --transpose)
+//animate_compress.exe "Output/test.txt" Output 4 --bus shield8 (plans encode 4 for the 8 bit shield)
+//animate_compress.exe "Output/test.txt" Output 2 --rotate-horizontal cw (turns 480x320 frames clockwise instead of transposing)
 //animate_compress.exe "D:\jjbee\OneDrive\projects\Art\Cotton Candy\Pink_Cotton_Candy\Blinking\BMP" this 
 //valgrind --leak-check=yes --track-origins=yes  ./animate_compress "Output/test.txt" Output
+/**************************************************************************************************************
+ *                  Profiling
+ **************************************************************************************************************/
+//The stages a frame goes through on its way to a .arf, timed for --report
+enum pipeline_stage {stage_parse, stage_verify, stage_read, stage_rotate, stage_diff, stage_encode, stage_write, num_stages};
+const char* stage_names[num_stages] = {"parse", "verify", "read", "rotate", "diff", "encode", "write"};
+
+//Wall clock time in milliseconds
+double time_ms() {
+    struct timespec curr_time;
+    clock_gettime(CLOCK_MONOTONIC, &curr_time);
+    return curr_time.tv_sec*1000.0 + curr_time.tv_nsec/1000000.0;
+}
+/**************************************************************************************************************
+ *                  END Profiling
+ **************************************************************************************************************/
 /**************************************************************************************************************
  *                  BMP Handling 
  **************************************************************************************************************/
@@ -69,6 +117,7 @@
 #define last_BMP_attr  1
 #define curr_BMP_attr  2 
 #define total_BMP_attr 3
+#define no_frame_handle -1
 enum image_orientation {horizontal, vertical};
 enum draw_direction {up=0, down=1, left=2, right=3, invalid=0xff};
 struct BMP_attributes {
@@ -79,9 +128,15 @@ struct BMP_attributes {
     int offset;
     int size;
     enum image_orientation orientation;
+    bool top_down; //the file's rows are stored top first (a negative height), load_BMP_frame flips them
     enum draw_direction animate_dir;
     int16_t* BMP_pixel_array;
     char* BMP_header;
+    char* BMP_map; //the mapped BMP file. When set, the header and pixel array are read-only views into it
+    size_t BMP_map_size;
+    uint64_t pixel_hash; //hash of the pixel array, only filled in for --dedup
+    int pool_handle; //the frame pool buffer holding the pixel array (and a read in header), no_frame_handle for views into BMP_map
+    double load_ms[num_stages]; //how long loading it took, by stage (verify, read and rotate)
 };
 
 //Extracts the extension after the ".". Only works if there are no other "."
@@ -104,30 +159,37 @@ bool verify_bmp_file_name(char* file2check) {
     return out_bool;
 }
 
+#define BMP_min_header_bytes 0x22 //up to and including the compression type
 //Verifies that the file being read in is actually a BMP for this system
-//Also loads the BMP attribute struct while verifying
-bool verify_bmp(struct BMP_attributes* BMP_handler)
+//Also loads the BMP attribute struct while verifying. Checks the header in place (BMP_data is the start of the file)
+bool verify_bmp(struct BMP_attributes* BMP_handler, const char* BMP_data, size_t BMP_data_len)
 {   
     //See below website for BMP guidance:
     //https://en.wikipedia.org/wiki/BMP_file_format
     uint16_t two_byte_store; 
-    fread(&two_byte_store, 2, 1, BMP_handler->BMP_file);
+    if (BMP_data_len < BMP_min_header_bytes) {
+      fprintf(stderr, "Not a valid BMP \n");
+      return false;  
+    }
+    memcpy(&two_byte_store, BMP_data, 2);
     if(two_byte_store != 0x4D42) //0x4D42 is the BMP signature, stating it is a BMP
     {
       fprintf(stderr, "Not a valid BMP \n");
       return false;  
     }
     //extracts the BMP's size 
-    fread(&(BMP_handler->size), 4, 1, BMP_handler->BMP_file);
+    memcpy(&(BMP_handler->size), BMP_data+0x2, 4);
     //skip the next four bytes because they're application specific
-    fseek(BMP_handler->BMP_file, 0x4, SEEK_CURR);
     //get offset to where pixel info is
-    fread(&(BMP_handler->offset), 4, 1, BMP_handler->BMP_file);
+    memcpy(&(BMP_handler->offset), BMP_data+0xA, 4);
     //skip Size of Header information
-    fseek(BMP_handler->BMP_file, 0x4, SEEK_CURR);
     //read width and height
-    fread(&(BMP_handler->width), 4, 1, BMP_handler->BMP_file);
-    fread(&(BMP_handler->height), 4, 1, BMP_handler->BMP_file);
+    memcpy(&(BMP_handler->width), BMP_data+0x12, 4);
+    memcpy(&(BMP_handler->height), BMP_data+0x16, 4);
+    //a negative height means the rows are stored top first, the other way around from every other frame
+    BMP_handler->top_down = BMP_handler->height < 0;
+    if (BMP_handler->top_down)
+        BMP_handler->height = -BMP_handler->height;
 
     //Check the width and height and determine the orientation
     if (BMP_handler->width == s_width && BMP_handler->height == s_height) {
@@ -142,30 +204,31 @@ bool verify_bmp(struct BMP_attributes* BMP_handler)
     }
 
     //Read the number of color panes (must be 1)
-    fread(&two_byte_store, 2, 1, BMP_handler->BMP_file);
+    memcpy(&two_byte_store, BMP_data+0x1A, 2);
     if(two_byte_store != 1) 
     {
         fprintf(stderr, "Number of Color Panes isn't 1\n");
         return false;
     }
     //The number of bits per pixel
-    fread(&two_byte_store, 2, 1, BMP_handler->BMP_file);
+    memcpy(&two_byte_store, BMP_data+0x1C, 2);
     if (two_byte_store != 16) {
       fprintf(stderr, "Color needs to be 16-bit color\n");
       return false;
     }
 
-    fread(&two_byte_store, 2, 1, BMP_handler->BMP_file);
+    memcpy(&two_byte_store, BMP_data+0x1E, 2);
     //make sure image is set to 3 for 565 images
     if(two_byte_store != 3)
     {
       fprintf(stderr, "Color needs to be R5G6B5\n");
       return false; 
      }
-    //load the BMP file header
-    fseek(BMP_handler->BMP_file, 0x0, SEEK_SET); 
-    BMP_handler->BMP_header = (char*)malloc(BMP_handler->offset); 
-    fread(BMP_handler->BMP_header, 1, BMP_handler->offset, BMP_handler->BMP_file);
+    //the pixel array has to fit after the header
+    if (BMP_handler->offset < BMP_min_header_bytes || BMP_handler->size-BMP_handler->offset < s_width*s_height*2) {
+      fprintf(stderr, "BMP pixel array is too small\n");
+      return false;
+    }
     return true;
 }
 
@@ -178,61 +241,240 @@ void free_BMP_attr(BMP_attributes* BMP_handler) {
 /**************************************************************************************************************
  *                  END BMP Handling 
  **************************************************************************************************************/
+/**************************************************************************************************************
+ *                  Frame Pool
+ **************************************************************************************************************/
+#define frame_pixel_bytes (s_width*s_height*sizeof(int16_t))
+#define frame_header_bytes 256 //fits every BMP info header version plus the R5G6B5 color masks
+//A fixed number of full screen pixel buffers (and header slabs) allocated once up front. Frames take a buffer by 
+//handle and give it back when they're done, so the peak memory is capacity frames no matter how many are encoded
+//Only the thread loading frames touches the pool
+struct frame_pool {
+    int capacity;
+    int16_t* pixel_slab;
+    char* header_slab;
+    int* free_handles; //stack of the handles that aren't in use
+    int num_free;
+    int peak_in_use;
+};
+
+bool frame_pool_init(struct frame_pool* pool, int capacity) {
+    pool->capacity = capacity;
+    pool->pixel_slab = (int16_t*)malloc(capacity*frame_pixel_bytes);
+    pool->header_slab = (char*)malloc(capacity*frame_header_bytes);
+    pool->free_handles = (int*)malloc(capacity*sizeof(int));
+    if (pool->pixel_slab == NULL || pool->header_slab == NULL || pool->free_handles == NULL) {
+        fprintf(stderr, "ERROR, Failed to allocate a frame pool of %d frames\n", capacity);
+        return false;
+    }
+    //hand out the low handles first
+    for (int i = 0; i < capacity; i++)
+        pool->free_handles[i] = capacity-1-i;
+    pool->num_free = capacity;
+    pool->peak_in_use = 0;
+    return true;
+}
+
+void frame_pool_free(struct frame_pool* pool) {
+    free(pool->pixel_slab);
+    free(pool->header_slab);
+    free(pool->free_handles);
+    pool->pixel_slab = NULL;
+    pool->header_slab = NULL;
+    pool->free_handles = NULL;
+    pool->capacity = 0;
+    pool->num_free = 0;
+}
+
+//Takes a buffer out of the pool. Returns no_frame_handle (with the error printed) when they're all in use
+int frame_pool_acquire(struct frame_pool* pool) {
+    if (pool->num_free == 0) {
+        fprintf(stderr, "ERROR, All %d frame buffers are in use\n", pool->capacity);
+        return no_frame_handle;
+    }
+    int handle = pool->free_handles[--pool->num_free];
+    if (pool->capacity-pool->num_free > pool->peak_in_use)
+        pool->peak_in_use = pool->capacity-pool->num_free;
+    return handle;
+}
+
+void frame_pool_release(struct frame_pool* pool, int handle) {
+    if (handle != no_frame_handle)
+        pool->free_handles[pool->num_free++] = handle;
+}
+
+inline int16_t* frame_pool_pixels(struct frame_pool* pool, int handle) {
+    return pool->pixel_slab + (size_t)handle*(s_width*s_height);
+}
+
+inline char* frame_pool_header(struct frame_pool* pool, int handle) {
+    return pool->header_slab + (size_t)handle*frame_header_bytes;
+}
+
+//Gives back what load_BMP_frame set up, either unmapping the file or releasing its pool buffer
+void free_BMP_frame(struct BMP_attributes* BMP_frame, struct frame_pool* pool) {
+    frame_pool_release(pool, BMP_frame->pool_handle);
+#if use_mmap_ingest
+    if (BMP_frame->BMP_map)
+        munmap(BMP_frame->BMP_map, BMP_frame->BMP_map_size);
+#endif
+    BMP_frame->BMP_pixel_array = NULL;
+    BMP_frame->BMP_header = NULL;
+    BMP_frame->BMP_map = NULL;
+    BMP_frame->pool_handle = no_frame_handle;
+}
+/**************************************************************************************************************
+ *                  END Frame Pool
+ **************************************************************************************************************/
 /**************************************************************************************************************
  *                  Matrix Manipulation
  **************************************************************************************************************/
-//Flips the BMP pixel array with a space complexity of O(1)
-void flip_BMP_pixel_arr(struct BMP_attributes* BMP2flip, enum image_orientation axis2flip) {
+#define transpose_tile 32 //32 pixels of int16_t is one 64-byte cache line
+#if defined(__SSE2__)
+//Transposes one 8x8 block of pixels with SSE2 unpacks (16-bit, then 32-bit, then 64-bit interleaves)
+//The strides can be negative, which is how the rotations flip while they transpose
+inline void transpose_8x8_sse2(const int16_t* src_block, ptrdiff_t src_stride, int16_t* dst_block, ptrdiff_t dst_stride) {
+    __m128i rows[8], pairs[8], quads[8];
+    for (int i = 0; i < 8; i++)
+        rows[i] = _mm_loadu_si128((const __m128i*)(src_block + i*src_stride));
+    for (int i = 0; i < 4; i++) {
+        pairs[i] = _mm_unpacklo_epi16(rows[2*i], rows[2*i+1]);
+        pairs[i+4] = _mm_unpackhi_epi16(rows[2*i], rows[2*i+1]);
+    }
+    //pairs[0..3] hold columns 0-3 of row pairs (0,1) (2,3) (4,5) (6,7), pairs[4..7] hold columns 4-7
+    for (int half = 0; half < 2; half++) {
+        quads[half*4+0] = _mm_unpacklo_epi32(pairs[half*4+0], pairs[half*4+1]);
+        quads[half*4+1] = _mm_unpackhi_epi32(pairs[half*4+0], pairs[half*4+1]);
+        quads[half*4+2] = _mm_unpacklo_epi32(pairs[half*4+2], pairs[half*4+3]);
+        quads[half*4+3] = _mm_unpackhi_epi32(pairs[half*4+2], pairs[half*4+3]);
+    }
+    for (int half = 0; half < 2; half++) {
+        for (int i = 0; i < 2; i++) {
+            int col_num = half*4 + i*2;
+            _mm_storeu_si128((__m128i*)(dst_block + col_num*dst_stride), _mm_unpacklo_epi64(quads[half*4+i], quads[half*4+i+2]));
+            _mm_storeu_si128((__m128i*)(dst_block + (col_num+1)*dst_stride), _mm_unpackhi_epi64(quads[half*4+i], quads[half*4+i+2]));
+        }
+    }
+}
+
+//Reverses the order of the 8 pixels in a vector
+inline __m128i reverse_8_sse2(__m128i pixels) {
+    pixels = _mm_shufflelo_epi16(pixels, 0x1B);
+    pixels = _mm_shufflehi_epi16(pixels, 0x1B);
+    return _mm_shuffle_epi32(pixels, 0x4E);
+}
+#endif
+
+//Transposes num_rows x num_cols pixels, where src row r starts at src_pixels+r*src_stride and dst row c starts 
+//at dst_pixels+c*dst_stride (dst[c][r] = src[r][c]). Goes tile by tile so the reads and the strided writes both 
+//stay inside a handful of cache lines
+void transpose_pixels_strided(const int16_t* src_pixels, ptrdiff_t src_stride, int num_rows, int num_cols, int16_t* dst_pixels, ptrdiff_t dst_stride) {
+    for (int tile_row = 0; tile_row < num_rows; tile_row += transpose_tile) {
+        int row_end = tile_row + transpose_tile < num_rows ? tile_row + transpose_tile : num_rows;
+        for (int tile_col = 0; tile_col < num_cols; tile_col += transpose_tile) {
+            int col_end = tile_col + transpose_tile < num_cols ? tile_col + transpose_tile : num_cols;
+#if defined(__SSE2__)
+            //full tiles go through the 8x8 kernel
+            if (row_end - tile_row == transpose_tile && col_end - tile_col == transpose_tile) {
+                for (int block_row = tile_row; block_row < row_end; block_row += 8) {
+                    for (int block_col = tile_col; block_col < col_end; block_col += 8)
+                        transpose_8x8_sse2(src_pixels + block_row*src_stride + block_col, src_stride, dst_pixels + block_col*dst_stride + block_row, dst_stride);
+                }
+                continue;
+            }
+#endif
+            for (int row_num = tile_row; row_num < row_end; row_num++) {
+                const int16_t* src_row = src_pixels + row_num*src_stride;
+                int16_t* dst_col = dst_pixels + row_num;
+                for (int col_num = tile_col; col_num < col_end; col_num++)
+                    dst_col[col_num*dst_stride] = src_row[col_num];
+            }
+        }
+    }
+}
+
+//Transposes a num_rows x num_cols pixel array into a num_cols x num_rows pixel array (columns become rows)
+void transpose_pixels(const int16_t* src_pixels, int num_rows, int num_cols, int16_t* dst_pixels) {
+    transpose_pixels_strided(src_pixels, num_cols, num_rows, num_cols, dst_pixels, num_rows);
+}
+
+//Copies num_pixels pixels from src_row to dst_row in reverse order. The rows can be the same row
+void reverse_pixel_row(const int16_t* src_row, int16_t* dst_row, int num_pixels) {
+    int front = 0, back = num_pixels;
+#if defined(__SSE2__)
+    //swap 8 pixels from each end at a time, so it also works in place
+    for (; back - front >= 16; front += 8, back -= 8) {
+        __m128i front_pixels = _mm_loadu_si128((const __m128i*)(src_row+front));
+        __m128i back_pixels = _mm_loadu_si128((const __m128i*)(src_row+back-8));
+        _mm_storeu_si128((__m128i*)(dst_row+front), reverse_8_sse2(back_pixels));
+        _mm_storeu_si128((__m128i*)(dst_row+back-8), reverse_8_sse2(front_pixels));
+    }
+#endif
+    for (back--; front <= back; front++, back--) {
+        int16_t temp_int16 = src_row[front];
+        dst_row[front] = src_row[back];
+        dst_row[back] = temp_int16;
+    }
+}
+
+#define flip_swap_chunk 64 //pixels an in place vertical flip swaps at a time, on the stack so no call allocates
+//Flips num_rows x num_cols pixels into dst_pixels (which can be src_pixels for an in place flip)
+//vertical swaps whole rows, horizontal reverses each row
+void flip_pixels(const int16_t* src_pixels, int16_t* dst_pixels, int num_rows, int num_cols, enum image_orientation axis2flip) {
     switch (axis2flip) {
         case vertical:
-            for (int16_t row_num = 0; row_num < BMP2flip->height/2; row_num++) {
-                for (int16_t col_num = 0; col_num < BMP2flip->width; col_num++) {
-                    int16_t temp_int16 = BMP2flip->BMP_pixel_array[rowcol2offset(row_num, col_num, BMP2flip->width)];
-                    BMP2flip->BMP_pixel_array[rowcol2offset(row_num, col_num, BMP2flip->width)] = BMP2flip->BMP_pixel_array[rowcol2offset(BMP2flip->height-1-row_num, col_num, BMP2flip->width)];
-                    BMP2flip->BMP_pixel_array[rowcol2offset(BMP2flip->height-1-row_num, col_num, BMP2flip->width)] = temp_int16;
+            if (src_pixels == dst_pixels) {
+                int16_t swap_chunk[flip_swap_chunk];
+                for (int row_num = 0; row_num < num_rows/2; row_num++) {
+                    int16_t* top_row = dst_pixels + (size_t)row_num*num_cols;
+                    int16_t* bottom_row = dst_pixels + (size_t)(num_rows-1-row_num)*num_cols;
+                    for (int col_num = 0; col_num < num_cols; col_num += flip_swap_chunk) {
+                        size_t chunk_bytes = (num_cols-col_num < flip_swap_chunk ? num_cols-col_num : flip_swap_chunk)*sizeof(int16_t);
+                        memcpy(swap_chunk, top_row+col_num, chunk_bytes);
+                        memcpy(top_row+col_num, bottom_row+col_num, chunk_bytes);
+                        memcpy(bottom_row+col_num, swap_chunk, chunk_bytes);
+                    }
                 }
             }
+            else {
+                for (int row_num = 0; row_num < num_rows; row_num++)
+                    memcpy(dst_pixels + (size_t)(num_rows-1-row_num)*num_cols, src_pixels + (size_t)row_num*num_cols, num_cols*sizeof(int16_t));
+            }
         break;
         case horizontal:
-            for (int16_t col_num = 0; col_num < BMP2flip->width/2; col_num++) {
-                for (int16_t row_num = 0; row_num < BMP2flip->height; row_num++) {
-                    int16_t temp_int16 = BMP2flip->BMP_pixel_array[rowcol2offset(row_num, col_num, BMP2flip->width)];
-                    BMP2flip->BMP_pixel_array[rowcol2offset(row_num, col_num, BMP2flip->width)] = BMP2flip->BMP_pixel_array[rowcol2offset(row_num, BMP2flip->width-1-col_num, BMP2flip->width)];
-                    BMP2flip->BMP_pixel_array[rowcol2offset(row_num, BMP2flip->width-1-col_num, BMP2flip->width)] = temp_int16;
-                }
-            }
+            for (int row_num = 0; row_num < num_rows; row_num++)
+                reverse_pixel_row(src_pixels + (size_t)row_num*num_cols, dst_pixels + (size_t)row_num*num_cols, num_cols);
         break;
     }
 }
 
-enum rotate {CW=0, CCW=1, clockwise=0, counter_clockwise=1};
-//Rotates the BMP pixel array clockwise or counter clockwise. Space complexity O((N*M))
-void rotate_BMP_pixel_arr(struct BMP_attributes* BMP2rot, enum rotate rotate_dir) {
-    int16_t* new_BMP_pixel_arr = (int16_t*)malloc((BMP2rot->size-BMP2rot->offset)); 
-    uint16_t insert_col_num = BMP2rot->height-1;
+//Flips the BMP pixel array into flipped_pixels, which can be the BMP's own pixel array to flip in place
+void flip_BMP_pixel_arr(struct BMP_attributes* BMP2flip, enum image_orientation axis2flip, int16_t* flipped_pixels) {
+    flip_pixels(BMP2flip->BMP_pixel_array, flipped_pixels, BMP2flip->height, BMP2flip->width, axis2flip);
+    BMP2flip->BMP_pixel_array = flipped_pixels;
+}
+
+enum rotate {CW=0, CCW=1, clockwise=0, counter_clockwise=1, transpose=2};
+//Rotates the BMP pixel array clockwise or counter clockwise (or transposes it) into rotated_pixels and points the 
+//BMP at them. Both rotations are a tiled transpose where one side is walked with a negative stride
+//Whoever owned the old pixel array still has to give it back
+void rotate_BMP_pixel_arr(struct BMP_attributes* BMP2rot, enum rotate rotate_dir, int16_t* rotated_pixels) {
+    const int16_t* src_pixels = BMP2rot->BMP_pixel_array;
+    int num_rows = BMP2rot->height, num_cols = BMP2rot->width;
     switch(rotate_dir) {
         case CCW:
-            for (uint16_t row_num = 0; row_num < BMP2rot->height; row_num++) {
-                for (uint16_t col_num = 0; col_num < BMP2rot->width; col_num++) {
-                    new_BMP_pixel_arr[rowcol2offset(col_num, insert_col_num, BMP2rot->height)] = BMP2rot->BMP_pixel_array[rowcol2offset(row_num, col_num, BMP2rot->width)];
-                }  
-                insert_col_num--;
-            }
+            //new[col][height-1-row] = old[row][col]: transpose the rows read bottom up
+            transpose_pixels_strided(src_pixels + (size_t)(num_rows-1)*num_cols, -(ptrdiff_t)num_cols, num_rows, num_cols, rotated_pixels, num_rows);
         break;
         case CW: 
-            
-            for (uint16_t row_num = 0; row_num < BMP2rot->height; row_num++) {
-                int insert_row_num = BMP2rot->width-1;
-                for (uint16_t col_num = 0; col_num < BMP2rot->width; col_num++) {
-                    new_BMP_pixel_arr[rowcol2offset(insert_row_num, row_num, BMP2rot->height)] = BMP2rot->BMP_pixel_array[rowcol2offset(row_num, col_num, BMP2rot->width)];
-                    insert_row_num--;
-                }     
-            }
+            //new[width-1-col][row] = old[row][col]: transpose into rows written bottom up
+            transpose_pixels_strided(src_pixels, num_cols, num_rows, num_cols, rotated_pixels + (size_t)(num_cols-1)*num_rows, -(ptrdiff_t)num_rows);
+        break;
+        case transpose:
+            transpose_pixels(src_pixels, num_rows, num_cols, rotated_pixels);
         break;
     }
-    int16_t* last_pixel_arr = BMP2rot->BMP_pixel_array;
-    BMP2rot->BMP_pixel_array = new_BMP_pixel_arr;
-    free(last_pixel_arr);
+    BMP2rot->BMP_pixel_array = rotated_pixels;
     int temp_width = BMP2rot->width;
     BMP2rot->width = BMP2rot->height; 
     BMP2rot->height = temp_width;
@@ -260,25 +502,25 @@ bool strcmp_sz(char* str1, char* str2, int sz) {
 }
 //extracts the file name from a char* with the file name and file extension
 char* extract_file_name(char* file_dir_name) {
-    char slash;
+    char slash[2] = {'\0', '\0'};
     switch(slash_chr) {
         case 0: //windows
-            slash = '\\';
+            slash[0] = '\\';
         break;
         case 1: //linux
-            slash = '/';
+            slash[0] = '/';
         break;
     }
     //verify that the file actually has one correct slash before continuing 
-    if (strchr(file_dir_name, slash) == NULL) {
+    if (strchr(file_dir_name, slash[0]) == NULL) {
         fprintf(stderr, "File Entry not in correct format. Reformat for desired OS file structure\n");
         return NULL;
     }
     char* file_loc = NULL;
-    char* next_file_loc = strchr(file_dir_name, slash);
+    char* next_file_loc = strchr(file_dir_name, slash[0]);
     while (next_file_loc) {
         file_loc = ++next_file_loc;
-        next_file_loc = strchr(next_file_loc, slash);
+        next_file_loc = strchr(next_file_loc, slash[0]);
     }
     return file_loc;
 }
@@ -286,16 +528,16 @@ char* extract_file_name(char* file_dir_name) {
 //combines the directory and the file name together and outputs it
 void directory_file_combine(char * input_file_str, char * input_dir_str, char * input_file_name) {
         strcpy(input_file_str, input_dir_str);
-        char slash;
+        char slash[2] = {'\0', '\0'};
         switch(slash_chr) {
             case 0: //windows
-                slash = '\\';
+                slash[0] = '\\';
             break;
             case 1: //linux
-                slash = '/';
+                slash[0] = '/';
             break;
         }
-        strcat(input_file_str, &slash); 
+        strcat(input_file_str, slash); 
         strcat(input_file_str, input_file_name);
 }
 
@@ -317,16 +559,16 @@ void combine_file_names(char * name_of_new_file, char * last_file_str, char * cu
 //Combines the output file directory with the file name
 void file_name2output_dir(char * output_file_str, char * name_of_file, char * output_dir) {
     strcpy(output_file_str, output_dir);
-    char slash;
+    char slash[2] = {'\0', '\0'};
     switch(slash_chr) {
         case 0: //windows
-            slash = '\\';
+            slash[0] = '\\';
         break;
         case 1: //linux
-            slash = '/';
+            slash[0] = '/';
         break;
     }
-    strcat(output_file_str, &slash);
+    strcat(output_file_str, slash);
     strcat(output_file_str, name_of_file);
 }
 
@@ -416,8 +658,47 @@ void compress_r5g6b5(int16_t* compressed_color, char colors_in[3]) {
 /**************************************************************************************************************
  *                  Parse Input File (format file name, then draw direction)
  **************************************************************************************************************/
+//Turns a ping-pong setup file (F0 d0 F1 d1 ... Fn-1) into the whole loop F0 .. Fn-1 .. F1, so each frame is 
+//listed once but the animation plays forward and then backward. Going back, Fi+1 -> Fi is drawn the opposite 
+//way to Fi -> Fi+1, and the pair F1 -> F0 closes the loop. The direction after the last frame isn't used
+char** expand_ping_pong(char** cmd_file_data, int* num_lines) {
+    const char* reverse_dirs[4][2] = {
+        {"up", "down"}, 
+        {"down", "up"}, 
+        {"left", "right"}, 
+        {"right", "left"},
+    };
+    int num_frames = (*num_lines+1)/2;
+    if (num_frames < 2)
+        return cmd_file_data;
+    int num_expanded = (num_frames*2-2)*2;
+    char** expanded = (char**)malloc(num_expanded*sizeof(char*));
+    //the forward half keeps the lines as they are
+    int line = 0;
+    for (; line < num_frames*2-1; line++)
+        expanded[line] = cmd_file_data[line];
+    if (*num_lines > line)
+        free(cmd_file_data[line]);
+    //then back down to F1, the frame lines are copies so every line can be freed on its own
+    for (int frame = num_frames-2; frame >= 0; frame--) {
+        char* draw_dir = cmd_file_data[frame*2+1];
+        int dir = 0;
+        while (dir < 4 && strcmp(reverse_dirs[dir][0], draw_dir) != 0)
+            dir++;
+        //an unknown direction is kept, so it's reported the same as it would be going forward
+        expanded[line++] = strdup(dir < 4 ? reverse_dirs[dir][1] : draw_dir);
+        if (frame > 0)
+            expanded[line++] = strdup(cmd_file_data[frame*2]);
+    }
+    free(cmd_file_data);
+    *num_lines = num_expanded;
+    return expanded;
+}
+
 //parses the input cmd file (file name, then draw_direction). In ASCII format. Also removes \n and anything past file . extension
-char** read_cmd_file(int* num_lines_out, char* input_cmd_file_dir) {
+//A line starting with @ is a directive instead: @pingpong plays the frames forward and then backward (expand_ping_pong). 
+//ping_pong_out (when it isn't NULL) is set to whether it was there
+char** read_cmd_file(int* num_lines_out, char* input_cmd_file_dir, bool* ping_pong_out) {
     FILE * cmd_file; 
     int max_lines = 100;
     int grow_lines_realloc = 2;
@@ -432,8 +713,18 @@ char** read_cmd_file(int* num_lines_out, char* input_cmd_file_dir) {
     char *line = NULL;
     size_t len_line = 0;
     ssize_t read_line_chars;
+    bool ping_pong = false;
     //parse each line
     while ((read_line_chars = getline(&line, &len_line, cmd_file)) != -1) {
+        //directives aren't counted as lines, so the file name and draw direction lines keep their order
+        if (line[0] == '@') {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (strcmp(line, "@pingpong") == 0)
+                ping_pong = true;
+            else
+                fprintf(stderr, "Unknown setup file directive %s, it's ignored\n", line);
+            continue;
+        }
         //reallocate when too small
         if (num_lines >= max_lines) {
             max_lines *= grow_lines_realloc; 
@@ -458,14 +749,260 @@ char** read_cmd_file(int* num_lines_out, char* input_cmd_file_dir) {
     free(line);
     //reallocate to exact size
     cmd_file_out = (char**)realloc(cmd_file_out, num_lines*sizeof(char*));
-    *num_lines_out = num_lines;
     fclose(cmd_file);
+    if (ping_pong)
+        cmd_file_out = expand_ping_pong(cmd_file_out, &num_lines);
+    if (ping_pong_out)
+        *ping_pong_out = ping_pong;
+    *num_lines_out = num_lines;
     return cmd_file_out;
 
 }
+//parses a batch file (setup file, then output folder, for each animation). Blank lines are skipped and the 
+//line endings are removed, so both lines can hold any path
+char** read_batch_file(int* num_lines_out, char* batch_file_dir) {
+    FILE * batch_file; 
+    if (NULL == (batch_file = fopen(batch_file_dir, "r"))) {
+        fprintf(stderr, "File Open Failiure\n");
+        return NULL;
+    }
+    int max_lines = 16;
+    int num_lines = 0;
+    char** batch_file_out = (char**)malloc(max_lines*sizeof(char*)); 
+    char *line = NULL;
+    size_t len_line = 0;
+    ssize_t read_line_chars;
+    while ((read_line_chars = getline(&line, &len_line, batch_file)) != -1) {
+        while (read_line_chars > 0 && (line[read_line_chars-1] == '\n' || line[read_line_chars-1] == '\r'))
+            line[--read_line_chars] = '\0';
+        if (read_line_chars == 0)
+            continue;
+        if (num_lines >= max_lines) {
+            max_lines *= 2; 
+            batch_file_out = (char**)realloc(batch_file_out, max_lines*sizeof(char*));
+        }
+        batch_file_out[num_lines++] = strdup(line);
+    }
+    free(line);
+    fclose(batch_file);
+    *num_lines_out = num_lines;
+    return batch_file_out;
+}
 /**************************************************************************************************************
  *                  END Parse Input File (format file name, then draw direction)
  **************************************************************************************************************/
+/**************************************************************************************************************
+ *                  Frame Differencing
+ **************************************************************************************************************/
+//The changed pixels between two frames, as one bit per pixel. Each line (row) of the frame gets mask_words 
+//64-bit words, where bit N of word W is set when pixel W*64+N of that line changed. Bits past the line are 0
+#define diff_mask_words(line_len) (((line_len)+63)/64)
+struct frame_diff {
+    int num_lines;
+    int line_len;
+    int mask_words;
+    uint64_t* change_mask;  //num_lines*mask_words words
+    int* line_changes;      //number of changed pixels on each line
+    uint64_t* column_mask;  //OR of every line's mask. Column traversals skip the columns that never changed
+    int total_changes;
+    bool transposed;        //the lines are the frame's columns (diffed from transposed pixel arrays)
+};
+
+void frame_diff_init(struct frame_diff* diff) {
+    memset(diff, 0, sizeof(struct frame_diff));
+}
+
+void frame_diff_free(struct frame_diff* diff) {
+    free(diff->change_mask);
+    free(diff->line_changes);
+    free(diff->column_mask);
+    frame_diff_init(diff);
+}
+
+inline const uint64_t* diff_line(const struct frame_diff* diff, int line_num) {
+    return diff->change_mask + (size_t)line_num*diff->mask_words;
+}
+
+inline bool diff_test(const struct frame_diff* diff, int line_num, int pixel_num) {
+    return (diff_line(diff, line_num)[pixel_num >> 6] >> (pixel_num & 63)) & 1;
+}
+
+//Compares one line of pixels and fills in its change mask. Returns the number of changed pixels
+int diff_line_mask(const int16_t* last_line, const int16_t* curr_line, int line_len, uint64_t* mask_out) {
+    int pixel_num = 0;
+    int num_changes = 0;
+    memset(mask_out, 0, diff_mask_words(line_len)*sizeof(uint64_t));
+#if defined(__AVX2__)
+    //32 pixels at a time. The packs interleave the 128-bit lanes, so the permute puts the pixels back in order
+    for (; pixel_num + 32 <= line_len; pixel_num += 32) {
+        __m256i equal_lo = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(last_line+pixel_num)), _mm256_loadu_si256((const __m256i*)(curr_line+pixel_num)));
+        __m256i equal_hi = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(last_line+pixel_num+16)), _mm256_loadu_si256((const __m256i*)(curr_line+pixel_num+16)));
+        __m256i equal_packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(equal_lo, equal_hi), 0xD8);
+        uint64_t changed_bits = (uint32_t)~_mm256_movemask_epi8(equal_packed);
+        mask_out[pixel_num >> 6] |= changed_bits << (pixel_num & 63);
+    }
+#endif
+#if defined(__SSE2__)
+    //16 pixels at a time
+    for (; pixel_num + 16 <= line_len; pixel_num += 16) {
+        __m128i equal_lo = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(last_line+pixel_num)), _mm_loadu_si128((const __m128i*)(curr_line+pixel_num)));
+        __m128i equal_hi = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(last_line+pixel_num+8)), _mm_loadu_si128((const __m128i*)(curr_line+pixel_num+8)));
+        uint64_t changed_bits = (uint16_t)~_mm_movemask_epi8(_mm_packs_epi16(equal_lo, equal_hi));
+        mask_out[pixel_num >> 6] |= changed_bits << (pixel_num & 63);
+    }
+#endif
+    //portable path. 4 pixels per 64-bit word, only looking at the pixels when the word changed
+    for (; pixel_num + 4 <= line_len; pixel_num += 4) {
+        uint64_t last_word, curr_word;
+        memcpy(&last_word, last_line+pixel_num, sizeof(uint64_t));
+        memcpy(&curr_word, curr_line+pixel_num, sizeof(uint64_t));
+        if (last_word == curr_word)
+            continue;
+        for (int i = 0; i < 4; i++) {
+            if (last_line[pixel_num+i] != curr_line[pixel_num+i])
+                mask_out[(pixel_num+i) >> 6] |= 1ULL << ((pixel_num+i) & 63);
+        }
+    }
+    for (; pixel_num < line_len; pixel_num++) {
+        if (last_line[pixel_num] != curr_line[pixel_num])
+            mask_out[pixel_num >> 6] |= 1ULL << (pixel_num & 63);
+    }
+    for (int word = 0; word < diff_mask_words(line_len); word++) {
+        num_changes += __builtin_popcountll(mask_out[word]);
+    }
+    return num_changes;
+}
+
+//Diffs two frames of num_lines lines (stored line after line) into diff. Reuses diff's buffers when they fit
+void diff_frames(const int16_t* last_pixels, const int16_t* curr_pixels, int num_lines, int line_len, struct frame_diff* diff) {
+    int mask_words = diff_mask_words(line_len);
+    if (diff->change_mask == NULL || diff->num_lines*diff->mask_words < num_lines*mask_words || diff->num_lines < num_lines || diff->mask_words < mask_words) {
+        frame_diff_free(diff);
+        diff->change_mask = (uint64_t*)malloc((size_t)num_lines*mask_words*sizeof(uint64_t));
+        diff->line_changes = (int*)malloc(num_lines*sizeof(int));
+        diff->column_mask = (uint64_t*)malloc(mask_words*sizeof(uint64_t));
+    }
+    diff->num_lines = num_lines;
+    diff->line_len = line_len;
+    diff->mask_words = mask_words;
+    diff->total_changes = 0;
+    diff->transposed = false;
+    memset(diff->column_mask, 0, mask_words*sizeof(uint64_t));
+    for (int line_num = 0; line_num < num_lines; line_num++) {
+        uint64_t* line_mask = diff->change_mask + (size_t)line_num*mask_words;
+        diff->line_changes[line_num] = diff_line_mask(last_pixels + (size_t)line_num*line_len, curr_pixels + (size_t)line_num*line_len, line_len, line_mask);
+        diff->total_changes += diff->line_changes[line_num];
+        if (diff->line_changes[line_num]) {
+            for (int word = 0; word < mask_words; word++)
+                diff->column_mask[word] |= line_mask[word];
+        }
+    }
+}
+
+//Finds the next run of changed pixels on a line at or after *pixel_num. Sets the run as [run_start, run_end)
+//and moves *pixel_num past it. Returns false when there are no more changed pixels on the line
+inline bool next_change_run(const uint64_t* line_mask, int mask_words, int line_len, int* pixel_num, int* run_start, int* run_end) {
+    if (*pixel_num >= line_len)
+        return false;
+    int word = *pixel_num >> 6;
+    uint64_t bits = line_mask[word] & (~0ULL << (*pixel_num & 63));
+    while (bits == 0) {
+        if (++word >= mask_words)
+            return false;
+        bits = line_mask[word];
+    }
+    *run_start = word*64 + __builtin_ctzll(bits);
+    //now look for the first unchanged pixel after the start
+    bits = ~line_mask[word] & (~0ULL << (*run_start & 63));
+    while (bits == 0) {
+        if (++word >= mask_words) {
+            *run_end = line_len;
+            *pixel_num = line_len;
+            return true;
+        }
+        bits = ~line_mask[word];
+    }
+    *run_end = word*64 + __builtin_ctzll(bits);
+    if (*run_end > line_len)
+        *run_end = line_len;
+    *pixel_num = *run_end;
+    return true;
+}
+
+//The shape of a frame pair's changes for --report, in the frame's rows whichever way it was diffed: the box around
+//the changed pixels (x0, y0, x1, y1, inclusive, all -1 when nothing changed), the rows with a change and the runs
+//of changed pixels along those rows
+void frame_diff_stats(const struct frame_diff* diff, int16_t bounds[4], int* changed_rows, int* num_spans) {
+    bounds[0] = bounds[1] = bounds[2] = bounds[3] = -1;
+    *changed_rows = 0;
+    *num_spans = 0;
+    for (int row = 0; row < s_height; row++) {
+        int row_spans = 0;
+        int pixel_num = 0, run_start, run_end;
+        if (!diff->transposed) {
+            if (diff->line_changes[row] == 0)
+                continue;
+            while (next_change_run(diff_line(diff, row), diff->mask_words, s_width, &pixel_num, &run_start, &run_end)) {
+                if (row_spans++ == 0 && (bounds[0] < 0 || run_start < bounds[0]))
+                    bounds[0] = run_start;
+                if (run_end-1 > bounds[2])
+                    bounds[2] = run_end-1;
+            }
+        }
+        else {
+            //the lines are columns, so the row is one bit out of each of them
+            bool in_run = false;
+            for (int col = 0; col < s_width; col++) {
+                bool changed = diff_test(diff, col, row);
+                if (changed && !in_run) {
+                    if (row_spans++ == 0 && (bounds[0] < 0 || col < bounds[0]))
+                        bounds[0] = col;
+                }
+                if (changed && col > bounds[2])
+                    bounds[2] = col;
+                in_run = changed;
+            }
+        }
+        if (row_spans == 0)
+            continue;
+        if (bounds[1] < 0)
+            bounds[1] = row;
+        bounds[3] = row;
+        (*changed_rows)++;
+        *num_spans += row_spans;
+    }
+}
+
+//Puts the frame that will actually be shown into snapped_out (which can be target itself). Any pixel of target 
+//whose color is within tolerance of what's already on the screen (shown) keeps the shown color, so 1 bit export 
+//jitter doesn't become entries. Green has an extra bit, so its threshold is doubled. Since the next frame is 
+//compared against this shown frame rather than its own target, the error never goes past tolerance
+//returns the number of pixels that would have changed but were left alone
+int snap_frame_pixels(const int16_t* shown, const int16_t* target, int16_t* snapped_out, int tolerance) {
+    int pixels_snapped = 0;
+    for (int i = 0; i < s_width*s_height; i++) {
+        int16_t target_color = target[i];
+        if (target_color == shown[i]) {
+            snapped_out[i] = target_color;
+            continue;
+        }
+        int16_t shown_color = shown[i];
+        char target_rgb[3], shown_rgb[3];
+        decompress_r5g6b5(&target_color, target_rgb);
+        decompress_r5g6b5(&shown_color, shown_rgb);
+        if (abs(target_rgb[0]-shown_rgb[0]) <= tolerance && abs(target_rgb[1]-shown_rgb[1]) <= 2*tolerance && abs(target_rgb[2]-shown_rgb[2]) <= tolerance) {
+            snapped_out[i] = shown_color;
+            pixels_snapped++;
+        }
+        else {
+            snapped_out[i] = target_color;
+        }
+    }
+    return pixels_snapped;
+}
+/**************************************************************************************************************
+ *                  END Frame Differencing
+ **************************************************************************************************************/
 /**************************************************************************************************************
  *                  ARF File Handler
  **************************************************************************************************************/
@@ -488,539 +1025,3376 @@ enum draw_direction draw_dir2num(char* draw_dir) {
     fprintf(stderr, "Invalid draw direction. Draw direction HAS to be lowercase and just the word and a new line character.");
     return (enum draw_direction)0xff; //-1 if fail
 }
+//Builds a whole .arf file in memory so it can be written out with a single write
+//Slots that are only known later (entry counts) are reserved with arf_write and filled in with arf_patch
+struct ARF_writer {
+    char* buffer;
+    size_t length;
+    size_t capacity;
+};
+
+void arf_writer_init(struct ARF_writer* arf_out) {
+    arf_out->capacity = 64*1024;
+    arf_out->buffer = (char*)malloc(arf_out->capacity);
+    arf_out->length = 0;
+}
+
+void arf_writer_free(struct ARF_writer* arf_out) {
+    free(arf_out->buffer);
+    arf_out->buffer = NULL;
+    arf_out->length = 0;
+    arf_out->capacity = 0;
+}
+
+//Keeps the buffer so the next frame can reuse it
+void arf_writer_reset(struct ARF_writer* arf_out) {
+    arf_out->length = 0;
+}
+
+//Appends num_bytes to the buffer. Returns the offset the data was written at
+inline size_t arf_write(struct ARF_writer* arf_out, const void* data, size_t num_bytes) {
+    if (arf_out->length + num_bytes > arf_out->capacity) {
+        while (arf_out->length + num_bytes > arf_out->capacity)
+            arf_out->capacity *= 2;
+        arf_out->buffer = (char*)realloc(arf_out->buffer, arf_out->capacity);
+    }
+    size_t data_offset = arf_out->length;
+    memcpy(arf_out->buffer+data_offset, data, num_bytes);
+    arf_out->length += num_bytes;
+    return data_offset;
+}
+
+//Overwrites bytes that were already written (reserved) at data_offset
+inline void arf_patch(struct ARF_writer* arf_out, size_t data_offset, const void* data, size_t num_bytes) {
+    memcpy(arf_out->buffer+data_offset, data, num_bytes);
+}
+
+//Writes the whole buffer out to the file
+bool arf_writer_flush(struct ARF_writer* arf_out, const char* file_dir) {
+    //the old file might be hard linked to the .arf cache, so it's replaced rather than written over
+    remove(file_dir);
+    FILE * output_file = fopen(file_dir, "wb");
+    if (output_file == NULL)
+        return false;
+    size_t bytes_written = fwrite(arf_out->buffer, 1, arf_out->length, output_file);
+    fclose(output_file);
+    return bytes_written == arf_out->length;
+}
+
 //sets up the arf file with the 2-byte start and allocates the 4-byte arf location for the pertinent info size
-void setup_arf(FILE * arf_file, enum draw_direction animate_dir, char encode_type) {
+void setup_arf(struct ARF_writer* arf_out, enum draw_direction animate_dir, char encode_type) {
     char arf_title [2] = {'A', 'R'};
-    fwrite(arf_title, 2, 1, arf_file); //Stores the "AR" title
+    arf_writer_reset(arf_out);
+    arf_write(arf_out, arf_title, 2); //Stores the "AR" title
     int temp_blank_space = 0;
-    fwrite(&temp_blank_space, sizeof(int), 1, arf_file); //Init stores size gap for the size
+    arf_write(arf_out, &temp_blank_space, sizeof(int)); //Init stores size gap for the size
     char animate_char = (char)animate_dir;
-    fwrite(&animate_char, sizeof(char), 1, arf_file);//Writes the direction to draw at
-    fwrite(&encode_type, sizeof(char), 1, arf_file); //Write out the encoding type
+    arf_write(arf_out, &animate_char, sizeof(char));//Writes the direction to draw at
+    arf_write(arf_out, &encode_type, sizeof(char)); //Write out the encoding type
 }
 
-//loads the output binary file with the pixels different between the last slide and current slide
-//outputs the number of entries into the file (actual file size is entries*6bytes+6)
-//uses the encoding type 1
-int load_arf_encode1(struct BMP_attributes* last_BMP, struct BMP_attributes* curr_BMP, FILE* output_file){
-    int16_t pos_val;
+//Direction traversal policies for the encoders. A frame is walked as lines (rows for up/down, columns for 
+//left/right), and each line as pixels. Everything is constexpr so each direction compiles to its own loop 
+//with fixed strides instead of doing row*width+col math per pixel
+//Contiguous lines sit one after the other in the pixel array and in the diff. That is always true for rows, and
+//true for columns once both frames have been transposed. Otherwise columns are walked with a stride of s_width
+template <bool lines_are_rows_in, bool lines_reversed_in, bool pixels_reversed_in, bool lines_contiguous_in = lines_are_rows_in>
+struct frame_traversal {
+    static constexpr bool lines_are_rows = lines_are_rows_in;
+    static constexpr bool lines_reversed = lines_reversed_in;   //walk the lines from last to first
+    static constexpr bool pixels_reversed = pixels_reversed_in; //walk each line from its last pixel to its first
+    static constexpr bool lines_contiguous = lines_contiguous_in;
+    static constexpr int num_lines = lines_are_rows ? s_height : s_width;
+    static constexpr int line_len = lines_are_rows ? s_width : s_height;
+    static constexpr int line_stride = lines_contiguous ? line_len : 1; //pixel array step from one line to the next
+    static constexpr int pixel_stride = lines_contiguous ? 1 : s_width; //pixel array step along a line
+    static constexpr int line_num(int line_step) { return lines_reversed ? num_lines-1-line_step : line_step; }
+    static constexpr int16_t x_pos(int line_num, int pixel_num) { return lines_are_rows ? pixel_num : line_num; }
+    static constexpr int16_t y_pos(int line_num, int pixel_num) { return lines_are_rows ? line_num : pixel_num; }
+    static constexpr bool rows_contiguous = lines_are_rows == lines_contiguous; //the pixel array is row by row (not transposed)
+    //A strided column's diff is stored by rows, so it only gets looked at if one of its pixels changed
+    static bool line_changed(const struct frame_diff* diff, int line_num) {
+        if (lines_contiguous)
+            return diff->line_changes[line_num] != 0;
+        return (diff->column_mask[line_num >> 6] >> (line_num & 63)) & 1;
+    }
+    static bool pixel_changed(const struct frame_diff* diff, int line_num, int pixel_num) {
+        return lines_contiguous ? diff_test(diff, line_num, pixel_num) : diff_test(diff, pixel_num, line_num);
+    }
+};
+//          (lines are rows, lines reversed, pixels reversed)
+typedef frame_traversal<true,  false, false> traverse_up;
+typedef frame_traversal<true,  true,  true>  traverse_down_by_pixel; //encode 1 plays the whole frame back to front
+typedef frame_traversal<true,  true,  false> traverse_down;
+typedef frame_traversal<false, false, false> traverse_left;
+typedef frame_traversal<false, true,  false> traverse_right;
+typedef frame_traversal<false, false, false, true> traverse_left_transposed;
+typedef frame_traversal<false, true,  false, true> traverse_right_transposed;
+
+//Finds the next run of changed pixels on a line at or after *pixel_num. Same as next_change_run, but works 
+//for both contiguous lines (straight off of the mask words) and strided columns (a bit test per pixel)
+template <class traversal>
+inline bool next_line_run(const struct frame_diff* diff, int line_num, int* pixel_num, int* run_start, int* run_end) {
+    if (traversal::lines_contiguous)
+        return next_change_run(diff_line(diff, line_num), diff->mask_words, traversal::line_len, pixel_num, run_start, run_end);
+    int curr_pixel = *pixel_num;
+    while (curr_pixel < traversal::line_len && !traversal::pixel_changed(diff, line_num, curr_pixel))
+        curr_pixel++;
+    if (curr_pixel >= traversal::line_len)
+        return false;
+    *run_start = curr_pixel;
+    while (curr_pixel < traversal::line_len && traversal::pixel_changed(diff, line_num, curr_pixel))
+        curr_pixel++;
+    *run_end = curr_pixel;
+    *pixel_num = curr_pixel;
+    return true;
+}
+
+//Encode 1 for a single direction. Every changed pixel is an [x, y, color] entry
+template <class traversal>
+int encode1_frame(const int16_t* curr_pixels, const struct frame_diff* diff, struct ARF_writer* output_arf) {
+    static_assert(!traversal::pixels_reversed || traversal::lines_contiguous, "reversed lines are walked straight off of the mask words");
+    int16_t entry[3]; //x location, y location, color
     int count_change = 0;
-    enum draw_direction draw_dir = curr_BMP->animate_dir;
-    fseek(output_file, 0x8, SEEK_SET);
-    //fprintf(stdout, "before draw_dir: %d, last_orient %d, curr_orient %d\n", (int)draw_dir, (int)last_BMP->orientation, (int)curr_BMP->orientation);  
-    switch(draw_dir) {
-        case up:
-            //fprintf(stdout, "after draw_dir: %d, last_orient %d, curr_orient %d\n", (int)draw_dir, (int)last_BMP->orientation, (int)curr_BMP->orientation);  
-            //loop through all of the values and compare between the two BMP pixels
-            for(int i = 0; i < (curr_BMP->size-curr_BMP->offset)/2; i++){
-                //If the file's value is not the same, isolate and store
-                if (last_BMP->BMP_pixel_array[i] != curr_BMP->BMP_pixel_array[i]) {
-                    //Find the width and height positions for the differing pixels 
-                    pos_val = offset2widthpos(i);
-                    fwrite(&pos_val, 2, 1, output_file);
-                    pos_val = offset2heightpos(i);
-                    fwrite(&pos_val, 2, 1, output_file);
-                    //Write the int16_t value out
-                    fwrite((curr_BMP->BMP_pixel_array)+i, 2, 1, output_file);
+    for (int line_step = 0; line_step < traversal::num_lines; line_step++) {
+        const int line_num = traversal::line_num(line_step);
+        if (!traversal::line_changed(diff, line_num))
+            continue;
+        const int16_t* line_pixels = curr_pixels + line_num*traversal::line_stride;
+        if (traversal::pixels_reversed) {
+            //go through the mask words from the top bit down
+            const uint64_t* line_mask = diff_line(diff, line_num);
+            for (int word = diff->mask_words-1; word >= 0; word--) {
+                uint64_t changed_bits = line_mask[word];
+                while (changed_bits) {
+                    int bit_num = 63 - __builtin_clzll(changed_bits);
+                    int pixel_num = word*64 + bit_num;
+                    changed_bits &= ~(1ULL << bit_num);
+                    entry[0] = traversal::x_pos(line_num, pixel_num);
+                    entry[1] = traversal::y_pos(line_num, pixel_num);
+                    entry[2] = line_pixels[pixel_num*traversal::pixel_stride];
+                    arf_write(output_arf, entry, sizeof(entry));
                     count_change++;
                 }
             }
-        break;
-        case down: //down
-            //fprintf(stdout, "after draw_dir: %d, last_orient %d, curr_orient %d\n", (int)draw_dir, (int)last_BMP->orientation, (int)curr_BMP->orientation);   
-            for(int i = (curr_BMP->size-curr_BMP->offset)/2 -1; i >= 0; i--){
-                //If the file's value is not the same, isolate and store
-                if (last_BMP->BMP_pixel_array[i] != curr_BMP->BMP_pixel_array[i]) {
-                    //Find the width and height positions for the differing pixels 
-                    pos_val = offset2widthpos(i);
-                    fwrite(&pos_val, 2, 1, output_file);
-                    pos_val = offset2heightpos(i);
-                    fwrite(&pos_val, 2, 1, output_file);
-                    //Write the int16_t value out
-                    fwrite((curr_BMP->BMP_pixel_array)+i, 2, 1, output_file);
+        }
+        else {
+            int pixel_num = 0, run_start, run_end;
+            while (next_line_run<traversal>(diff, line_num, &pixel_num, &run_start, &run_end)) {
+                const int16_t* run_pixel = line_pixels + run_start*traversal::pixel_stride;
+                for (int run_pixel_num = run_start; run_pixel_num < run_end; run_pixel_num++) {
+                    entry[0] = traversal::x_pos(line_num, run_pixel_num);
+                    entry[1] = traversal::y_pos(line_num, run_pixel_num);
+                    entry[2] = *run_pixel;
+                    arf_write(output_arf, entry, sizeof(entry));
+                    run_pixel += traversal::pixel_stride;
                     count_change++;
                 }
             }
-        break;
-        case left: 
-            //fprintf(stdout, "after draw_dir: %d, last_orient %d, curr_orient %d\n", (int)draw_dir, (int)last_BMP->orientation, (int)curr_BMP->orientation);  
-            for(int col_num=0; col_num < s_width; col_num++ ){
-                for (int row_num=0; row_num < s_height; row_num++) {
-                //If the file's value is not the same, isolate and store
-                    if (last_BMP->BMP_pixel_array[row_num*s_width+col_num] != curr_BMP->BMP_pixel_array[row_num*s_width+col_num]) {
-                        //Find the width and height positions for the differing pixels 
-                        pos_val = col_num;
-                        fwrite(&pos_val, 2, 1, output_file);
-                        pos_val = row_num;
-                        fwrite(&pos_val, 2, 1, output_file);
-                        //Write the int16_t value out
-                        fwrite((curr_BMP->BMP_pixel_array)+(row_num*s_width+col_num), 2, 1, output_file);
-                        count_change++;
-                    }  
-                }
-            }
-        break; 
-        case right: 
-            for(int col_num=s_width-1; col_num >= 0; col_num-- ){
-                for (int row_num=0; row_num < s_height; row_num++) {
-                //If the file's value is not the same, isolate and store
-                    if (last_BMP->BMP_pixel_array[row_num*s_width+col_num] != curr_BMP->BMP_pixel_array[row_num*s_width+col_num]) {
-                        //Find the width and height positions for the differing pixels 
-                        pos_val = col_num;
-                        fwrite(&pos_val, 2, 1, output_file);
-                        pos_val = row_num;
-                        fwrite(&pos_val, 2, 1, output_file);
-                        //Write the int16_t value out
-                        fwrite((curr_BMP->BMP_pixel_array)+(row_num*s_width+col_num), 2, 1, output_file);
-                        count_change++;
-                    }  
-                }
-            }
-        break;
-        case invalid: 
-            fprintf(stderr, "Invalid direction\n");
-        break;
+        }
     }
-    fprintf(stdout, "Encode 1 Count Changes: %d\n", count_change);
     return count_change;
 }
 
-//loads the output binary file with the pixels different between the last slide and current slide
-//outputs the number of entries into the file (entries are variable size, but its size is specified per line)
-//uses the encoding type 2
-int load_arf_encode2(struct BMP_attributes* last_BMP, struct BMP_attributes* curr_BMP, FILE* output_file){
-    int16_t temp_val;
+//Encode 2 for a single direction. Each line that changed gets a header [line location, num entries] and then 
+//one [color, start, end] entry per run of the same color inside each run of changed pixels. For rows the line
+//location is y and the entries are x ranges. For columns (left/right) the line location is x and the entries are y ranges
+template <class traversal>
+int encode2_frame(const int16_t* curr_pixels, const struct frame_diff* diff, struct ARF_writer* output_arf) {
+    static_assert(!traversal::pixels_reversed, "encode 2 entries always go from the start of the line to the end");
     int num_entries = 0;
-    enum draw_direction draw_dir = curr_BMP->animate_dir;
-    fseek(output_file, 0x8, SEEK_SET);
-    //fprintf(stdout, "before draw_dir: %d, last_orient %d, curr_orient %d\n", (int)draw_dir, (int)last_BMP->orientation, (int)curr_BMP->orientation);  
-    uint32_t offset4num_entries_on_row;
-    uint32_t output_file_offset = 0x8;
-    switch(draw_dir) {
-        case up:
-        /////////////////////////////////////////////////////////////////////////////
-            for(int16_t row_num=0; row_num < s_height; row_num++ ){
-                int num_entries_on_row = 0;
-                int16_t last_color;
-                bool on_line = false;
-                for (int16_t col_num=0; col_num < s_width; col_num++) {
-                    if (last_BMP->BMP_pixel_array[row_num*s_width+col_num] != curr_BMP->BMP_pixel_array[row_num*s_width+col_num]) {
-                        if (num_entries_on_row == 0) {
-                            fwrite(&row_num, 2, 1, output_file);
-                            output_file_offset+=2;
-                            offset4num_entries_on_row = output_file_offset;//store where the num_entries_on_row is at
-                            temp_val = 0xABCD;
-                            fwrite(&temp_val, 2, 1, output_file);//creates space for the num_entries_on_row
-                            last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num];
-                            fwrite(&last_color, 2, 1, output_file);//write out the color
-                            fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                            num_entries_on_row++;
-                            num_entries++;//set up that there is a new entry
-                            output_file_offset+=6;//go to the next offset
-                            on_line = true; 
-                        }
-                        else {
-                            //if we're on a line and we're at the change in color, change the color
-                            if (on_line) {
-                                if (last_color != curr_BMP->BMP_pixel_array[row_num*s_width+col_num]) {
-                                    last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num]; 
-                                    temp_val = col_num-1;
-                                    fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                                    fwrite(&last_color, 2, 1, output_file);//write out the color
-                                    fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                                    num_entries_on_row++;
-                                    output_file_offset+=6;//go to the next offset
-                                    on_line = true; 
-                                }
-                            }
-                            else {
-                                //set the last color to the current color if different
-                                if (last_color != curr_BMP->BMP_pixel_array[row_num*s_width+col_num])
-                                    last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num];
-                                //if we're not on a line, then we're now on a new line and add the new color and start pos
-                                fwrite(&last_color, 2, 1, output_file);//write out the color
-                                fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                                num_entries_on_row++;
-                                output_file_offset+=4;//go to the next offset
-                                on_line = true; 
-                            }
-                        }
-                    }
-                    else {
-                        //if we aren't on changing bits, then if we were on a line, end that line
-                        if (on_line) {
-                            temp_val = col_num-1;
-                            fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                            output_file_offset+=2;
-                            on_line = false; 
-                        }
-                    }
-                }
-                if (on_line) {
-                    temp_val = s_width-1;
-                    fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                    output_file_offset+=2;
-                    on_line = false; 
-                }
-                //if there was an entry on the row, fill in the entry number 
-                if (num_entries_on_row > 0) {
-                    fseek(output_file, offset4num_entries_on_row, SEEK_SET); 
-                    fwrite(&num_entries_on_row, 2, 1, output_file); 
-                    fseek(output_file, output_file_offset, SEEK_SET);
-                }
-            }
-        break;
-        case down:
-        /////////////////////////////////////////////////////////////////////////////
-            for(int16_t row_num=s_height-1; row_num >= 0; row_num--){
-                int num_entries_on_row = 0;
-                int16_t last_color;
-                bool on_line = false;
-                for (int16_t col_num=0; col_num < s_width; col_num++) {
-                    if (last_BMP->BMP_pixel_array[row_num*s_width+col_num] != curr_BMP->BMP_pixel_array[row_num*s_width+col_num]) {
-                        if (num_entries_on_row == 0) {
-                            fwrite(&row_num, 2, 1, output_file);
-                            output_file_offset+=2;
-                            offset4num_entries_on_row = output_file_offset;//store where the num_entries_on_row is at
-                            temp_val = 0xABCD;
-                            fwrite(&temp_val, 2, 1, output_file);//creates space for the num_entries_on_row
-                            last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num];
-                            fwrite(&last_color, 2, 1, output_file);//write out the color
-                            fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                            num_entries_on_row++;
-                            num_entries++;//set up that there is a new entry
-                            output_file_offset+=6;//go to the next offset
-                            on_line = true; 
-                        }
-                        else {
-                            //if we're on a line and we're at the change in color, change the color
-                            if (on_line) {
-                                if (last_color != curr_BMP->BMP_pixel_array[row_num*s_width+col_num]) {
-                                    last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num]; 
-                                    temp_val = col_num-1;
-                                    fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                                    fwrite(&last_color, 2, 1, output_file);//write out the color
-                                    fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                                    num_entries_on_row++;
-                                    output_file_offset+=6;//go to the next offset
-                                    on_line = true; 
-                                }
-                            }
-                            else {
-                                //set the last color to the current color if different
-                                if (last_color != curr_BMP->BMP_pixel_array[row_num*s_width+col_num])
-                                    last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num];
-                                //if we're not on a line, then we're now on a new line and add the new color and start pos
-                                fwrite(&last_color, 2, 1, output_file);//write out the color
-                                fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                                num_entries_on_row++;
-                                output_file_offset+=4;//go to the next offset
-                                on_line = true; 
-                            }
-                        }
-                    }
-                    else {
-                        //if we aren't on changing bits, then if we were on a line, end that line
-                        if (on_line) {
-                            temp_val = col_num-1;
-                            fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                            output_file_offset+=2;
-                            on_line = false; 
-                        }
-                    }
-                }
-                if (on_line) {
-                    temp_val = s_width-1;
-                    fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                    output_file_offset+=2;
-                    on_line = false; 
-                }
-                //if there was an entry on the row, fill in the entry number 
-                if (num_entries_on_row > 0) {
-                    fseek(output_file, offset4num_entries_on_row, SEEK_SET); 
-                    fwrite(&num_entries_on_row, 2, 1, output_file); 
-                    fseek(output_file, output_file_offset, SEEK_SET);
-                }
-            }
-        break; 
-        case left:
-        /////////////////////////////////////////////////////////////////////////////
-            for(int16_t col_num=0; col_num < s_width; col_num++){
-                int num_entries_on_row = 0;
-                int16_t last_color;
-                bool on_line = false;
-                for (int16_t row_num=0; row_num < s_height; row_num++) {
-                    if (last_BMP->BMP_pixel_array[row_num*s_width+col_num] != curr_BMP->BMP_pixel_array[row_num*s_width+col_num]) {
-                        if (num_entries_on_row == 0) {
-                            fwrite(&row_num, 2, 1, output_file);
-                            output_file_offset+=2;
-                            offset4num_entries_on_row = output_file_offset;//store where the num_entries_on_row is at
-                            temp_val = 0xABCD;
-                            fwrite(&temp_val, 2, 1, output_file);//creates space for the num_entries_on_row
-                            last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num];
-                            fwrite(&last_color, 2, 1, output_file);//write out the color
-                            fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                            num_entries_on_row++;
-                            num_entries++;//set up that there is a new entry
-                            output_file_offset+=6;//go to the next offset
-                            on_line = true; 
-                        }
-                        else {
-                            //if we're on a line and we're at the change in color, change the color
-                            if (on_line) {
-                                if (last_color != curr_BMP->BMP_pixel_array[row_num*s_width+col_num]) {
-                                    last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num]; 
-                                    temp_val = col_num-1;
-                                    fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                                    fwrite(&last_color, 2, 1, output_file);//write out the color
-                                    fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                                    num_entries_on_row++;
-                                    output_file_offset+=6;//go to the next offset
-                                    on_line = true; 
-                                }
-                            }
-                            else {
-                                //set the last color to the current color if different
-                                if (last_color != curr_BMP->BMP_pixel_array[row_num*s_width+col_num])
-                                    last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num];
-                                //if we're not on a line, then we're now on a new line and add the new color and start pos
-                                fwrite(&last_color, 2, 1, output_file);//write out the color
-                                fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                                num_entries_on_row++;
-                                output_file_offset+=4;//go to the next offset
-                                on_line = true; 
-                            }
-                        }
-                    }
-                    else {
-                        //if we aren't on changing bits, then if we were on a line, end that line
-                        if (on_line) {
-                            temp_val = col_num-1;
-                            fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                            output_file_offset+=2;
-                            on_line = false; 
-                        }
-                    }
-                }
-                if (on_line) {
-                    temp_val = s_width-1;
-                    fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                    output_file_offset+=2;
-                    on_line = false; 
-                }
-                //if there was an entry on the row, fill in the entry number 
-                if (num_entries_on_row > 0) {
-                    fseek(output_file, offset4num_entries_on_row, SEEK_SET); 
-                    fwrite(&num_entries_on_row, 2, 1, output_file); 
-                    fseek(output_file, output_file_offset, SEEK_SET);
-                }
+    for (int line_step = 0; line_step < traversal::num_lines; line_step++) {
+        const int line_num = traversal::line_num(line_step);
+        if (!traversal::line_changed(diff, line_num))
+            continue;
+        const int16_t* line_pixels = curr_pixels + line_num*traversal::line_stride;
+        int num_entries_on_line = 0;
+        size_t offset4num_entries_on_line = 0;
+        int pixel_num = 0, run_start, run_end;
+        while (next_line_run<traversal>(diff, line_num, &pixel_num, &run_start, &run_end)) {
+            if (num_entries_on_line == 0) {
+                int16_t line_header[2] = {(int16_t)line_num, (int16_t)0xABCD};
+                //creates space for the num_entries_on_line, storing where it is at
+                offset4num_entries_on_line = arf_write(output_arf, line_header, sizeof(line_header)) + 2;
             }
-        break; 
-        case right:
-        /////////////////////////////////////////////////////////////////////////////
-            for(int16_t col_num=s_width-1; col_num >= 0; col_num--){
-                int num_entries_on_row = 0;
-                int16_t last_color;
-                bool on_line = false;
-                for (int16_t row_num=0; row_num < s_height; row_num++) {
-                    if (last_BMP->BMP_pixel_array[row_num*s_width+col_num] != curr_BMP->BMP_pixel_array[row_num*s_width+col_num]) {
-                        if (num_entries_on_row == 0) {
-                            fwrite(&row_num, 2, 1, output_file);
-                            output_file_offset+=2;
-                            offset4num_entries_on_row = output_file_offset;//store where the num_entries_on_row is at
-                            temp_val = 0xABCD;
-                            fwrite(&temp_val, 2, 1, output_file);//creates space for the num_entries_on_row
-                            last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num];
-                            fwrite(&last_color, 2, 1, output_file);//write out the color
-                            fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                            num_entries_on_row++;
-                            num_entries++;//set up that there is a new entry
-                            output_file_offset+=6;//go to the next offset
-                            on_line = true; 
-                        }
-                        else {
-                            //if we're on a line and we're at the change in color, change the color
-                            if (on_line) {
-                                if (last_color != curr_BMP->BMP_pixel_array[row_num*s_width+col_num]) {
-                                    last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num]; 
-                                    temp_val = col_num-1;
-                                    fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                                    fwrite(&last_color, 2, 1, output_file);//write out the color
-                                    fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                                    num_entries_on_row++;
-                                    output_file_offset+=6;//go to the next offset
-                                    on_line = true; 
-                                }
-                            }
-                            else {
-                                //set the last color to the current color if different
-                                if (last_color != curr_BMP->BMP_pixel_array[row_num*s_width+col_num])
-                                    last_color = curr_BMP->BMP_pixel_array[row_num*s_width+col_num];
-                                //if we're not on a line, then we're now on a new line and add the new color and start pos
-                                fwrite(&last_color, 2, 1, output_file);//write out the color
-                                fwrite(&col_num, 2, 1, output_file);//write out the starting width
-                                num_entries_on_row++;
-                                output_file_offset+=4;//go to the next offset
-                                on_line = true; 
-                            }
-                        }
-                    }
-                    else {
-                        //if we aren't on changing bits, then if we were on a line, end that line
-                        if (on_line) {
-                            temp_val = col_num-1;
-                            fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                            output_file_offset+=2;
-                            on_line = false; 
-                        }
-                    }
-                }
-                if (on_line) {
-                    temp_val = s_width-1;
-                    fwrite(&temp_val, 2, 1, output_file);//write out the finished width
-                    output_file_offset+=2;
-                    on_line = false; 
-                }
-                //if there was an entry on the row, fill in the entry number 
-                if (num_entries_on_row > 0) {
-                    fseek(output_file, offset4num_entries_on_row, SEEK_SET); 
-                    fwrite(&num_entries_on_row, 2, 1, output_file); 
-                    fseek(output_file, output_file_offset, SEEK_SET);
+            //split the changed run up wherever the color changes
+            int16_t entry[3]; //color, start location, finished location
+            int16_t line_color = line_pixels[run_start*traversal::pixel_stride];
+            int line_start = run_start;
+            const int16_t* run_pixel = line_pixels + (run_start+1)*traversal::pixel_stride;
+            for (int run_pixel_num = run_start+1; run_pixel_num <= run_end; run_pixel_num++) {
+                if (run_pixel_num == run_end || *run_pixel != line_color) {
+                    entry[0] = line_color;
+                    entry[1] = line_start;
+                    entry[2] = run_pixel_num-1;
+                    arf_write(output_arf, entry, sizeof(entry));
+                    num_entries_on_line++;
+                    line_start = run_pixel_num;
+                    if (run_pixel_num < run_end)
+                        line_color = *run_pixel;
                 }
+                run_pixel += traversal::pixel_stride;
             }
-        break;
-        case invalid: 
-            fprintf(stderr, "Invalid direction\n");
-            return 0;
-        break;
+        }
+        //if there was an entry on the line, fill in the entry number 
+        if (num_entries_on_line > 0) {
+            int16_t entries_on_line = num_entries_on_line;
+            arf_patch(output_arf, offset4num_entries_on_line, &entries_on_line, 2);
+            num_entries++;
+        }
     }
-
-    fprintf(stdout, "Encode 2 Count Changes: %d\n", num_entries);
     return num_entries;
 }
 
-//load the arf file with the number of entries in the file. Used to know when at the end of the file
-void load_arf_num_entries(FILE * arf_file, int num_entries) {
-    fseek(arf_file, 0x2, SEEK_SET);
-    fwrite(&num_entries, sizeof(int), 1, arf_file);
+#define window_cost 16 //opening an address window (CASET, PASET, RAMWR, plus reading the entry's header) costs about as much as pushing this many pixels
+#define literal_pixel_cost 2 //reading a pixel's color off of the SD card costs about as much as pushing this many pixels
+//A rectangle being grown by encode 3, in line coordinates. The lines are walk steps so it grows the way it's drawn
+struct dirty_rect {
+    int first_step;
+    int last_step;
+    int first_pixel;
+    int last_pixel; //inclusive
+};
+
+//Gets called with the screen bounds [x0, y0, x1, y1] (inclusive) of every rectangle grow_dirty_rects closes
+typedef void (*dirty_rect_done)(const int16_t rect_bounds[4], void* context);
+
+//Turns a rectangle's lines and pixels into screen bounds and hands them to rect_done
+template <class traversal>
+void close_dirty_rect(const struct dirty_rect* rect, dirty_rect_done rect_done, void* context) {
+    int first_line = traversal::line_num(rect->first_step), last_line = traversal::line_num(rect->last_step);
+    if (first_line > last_line) {
+        int temp_line = first_line;
+        first_line = last_line;
+        last_line = temp_line;
+    }
+    int16_t rect_bounds[4] = {traversal::x_pos(first_line, rect->first_pixel), traversal::y_pos(first_line, rect->first_pixel), 
+                              traversal::x_pos(last_line, rect->last_pixel), traversal::y_pos(last_line, rect->last_pixel)};
+    rect_done(rect_bounds, context);
 }
-//Taking in BMP attributes, creates the output files and spits out data to them
-void files2arf(struct BMP_attributes* last_BMP, struct BMP_attributes* curr_BMP, char* output_dir, int file_count, char encode_type) {
-    char name_of_output_file[512];
-    char output_file_str[512];
-    //First create the name of the output file
-    combine_file_names(name_of_output_file, last_BMP->file_name, curr_BMP->file_name, file_count);
-    file_name2output_dir(output_file_str, name_of_output_file, output_dir);
-    fprintf(stdout, "New File Name: %s\n", output_file_str);
 
-    //Now, can finally create the output file and analyze it next to the original buffer
-    FILE * output_file = fopen(output_file_str, "wb");
+struct encode3_context {
+    const int16_t* curr_pixels;
+    struct ARF_writer* output_arf;
+};
 
-    //Load the output file binary
-    setup_arf(output_file, curr_BMP->animate_dir, encode_type);
-    int num_entries;
-    switch(encode_type) {
+//Writes one encode 3 entry: [x0, y0, x1, y1] then the rectangle's curr pixels, row by row (the order 
+//Push_Any_Color fills an address window in)
+template <class traversal>
+void write_dirty_rect(const int16_t rect_header[4], void* context) {
+    const int16_t* curr_pixels = ((struct encode3_context*)context)->curr_pixels;
+    struct ARF_writer* output_arf = ((struct encode3_context*)context)->output_arf;
+    arf_write(output_arf, rect_header, 4*sizeof(int16_t));
+    int rect_width = rect_header[2]-rect_header[0]+1;
+    for (int y = rect_header[1]; y <= rect_header[3]; y++) {
+        if (traversal::rows_contiguous) {
+            arf_write(output_arf, curr_pixels + y*s_width + rect_header[0], rect_width*sizeof(int16_t));
+        }
+        else {
+            //transposed frames are gathered a row at a time
+            int16_t row_pixels[s_width];
+            for (int x = 0; x < rect_width; x++)
+                row_pixels[x] = curr_pixels[(rect_header[0]+x)*s_height + y];
+            arf_write(output_arf, row_pixels, rect_width*sizeof(int16_t));
+        }
+    }
+}
+
+//Groups the changed pixels into rectangles that cover them. Rectangles are grown line by line in the draw order: 
+//each run of changes joins whichever open rectangle it costs the fewest extra pushed pixels to widen/lengthen, 
+//unless starting a new rectangle (window_cost plus the run) is cheaper. A rectangle that gets nothing on 
+//a line is closed and handed to rect_done
+//returns the number of rectangles
+template <class traversal>
+int grow_dirty_rects(const struct frame_diff* diff, dirty_rect_done rect_done, void* context) {
+    static_assert(!traversal::pixels_reversed, "rectangles are found from the start of the line to the end");
+    //every open rectangle got a run on the line before, so there are at most line_len/2+1 of them
+    struct dirty_rect open_rects[traversal::line_len/2+1];
+    bool rect_grown[traversal::line_len/2+1];
+    int num_open_rects = 0;
+    int num_entries = 0;
+    for (int line_step = 0; line_step < traversal::num_lines; line_step++) {
+        const int line_num = traversal::line_num(line_step);
+        int num_rects_before_line = num_open_rects;
+        for (int i = 0; i < num_open_rects; i++)
+            rect_grown[i] = false;
+        if (traversal::line_changed(diff, line_num)) {
+            int pixel_num = 0, run_start, run_end;
+            bool have_run = next_line_run<traversal>(diff, line_num, &pixel_num, &run_start, &run_end);
+            while (have_run) {
+                //runs closer together than a new window would cost get pushed as one
+                int span_start = run_start, span_end = run_end-1;
+                while ((have_run = next_line_run<traversal>(diff, line_num, &pixel_num, &run_start, &run_end)) && run_start-span_end-1 <= window_cost)
+                    span_end = run_end-1;
+                int span_len = span_end-span_start+1;
+                int best_rect = -1;
+                int best_cost = window_cost + span_len;
+                for (int i = 0; i < num_open_rects; i++) {
+                    struct dirty_rect* rect = &open_rects[i];
+                    if (span_end+window_cost < rect->first_pixel || span_start > rect->last_pixel+window_cost)
+                        continue;
+                    int rect_height = rect->last_step-rect->first_step+1;
+                    int grown_height = rect_grown[i] ? rect_height : rect_height+1;
+                    int grown_first = span_start < rect->first_pixel ? span_start : rect->first_pixel;
+                    int grown_last = span_end > rect->last_pixel ? span_end : rect->last_pixel;
+                    int added_pixels = grown_height*(grown_last-grown_first+1) - rect_height*(rect->last_pixel-rect->first_pixel+1);
+                    if (added_pixels < best_cost) {
+                        best_rect = i;
+                        best_cost = added_pixels;
+                    }
+                }
+                if (best_rect < 0) {
+                    best_rect = num_open_rects++;
+                    open_rects[best_rect].first_step = line_step;
+                    open_rects[best_rect].first_pixel = span_start;
+                    open_rects[best_rect].last_pixel = span_end;
+                }
+                struct dirty_rect* rect = &open_rects[best_rect];
+                rect->last_step = line_step;
+                if (span_start < rect->first_pixel)
+                    rect->first_pixel = span_start;
+                if (span_end > rect->last_pixel)
+                    rect->last_pixel = span_end;
+                rect_grown[best_rect] = true;
+            }
+        }
+        //close the rectangles that didn't grow onto this line
+        int num_still_open = 0;
+        for (int i = 0; i < num_open_rects; i++) {
+            if (i < num_rects_before_line && !rect_grown[i]) {
+                close_dirty_rect<traversal>(&open_rects[i], rect_done, context);
+                num_entries++;
+            }
+            else {
+                open_rects[num_still_open++] = open_rects[i];
+            }
+        }
+        num_open_rects = num_still_open;
+    }
+    for (int i = 0; i < num_open_rects; i++) {
+        close_dirty_rect<traversal>(&open_rects[i], rect_done, context);
+        num_entries++;
+    }
+    return num_entries;
+}
+
+//Encode 3 for a single direction. The changed pixels are grouped into rectangles (grow_dirty_rects), each one 
+//an entry of [x0, y0, x1, y1] followed by every pixel inside it. Unchanged pixels inside a rectangle are pushed as their (same) color
+template <class traversal>
+int encode3_frame(const int16_t* curr_pixels, const struct frame_diff* diff, struct ARF_writer* output_arf) {
+    struct encode3_context context = {curr_pixels, output_arf};
+    return grow_dirty_rects<traversal>(diff, write_dirty_rect<traversal>, &context);
+}
+
+//The smallest run of one color worth its own Fill_Rect in the middle of a literal run (it costs up to two more windows)
+#define solid_span_min (2*window_cost/literal_pixel_cost)
+//A run of one color or a run of pushed pixels on a line, for encode 4
+struct span_op {
+    int start;
+    int end; //inclusive
+    bool solid;
+};
+
+//Plans the ops for one stretch [seg_start, seg_end] of a line's pixels. Runs of one color that are at least 
+//solid_span_min long (or that fill the whole stretch) are solid, and whatever is between them is pushed 
+//as literal pixels. A literal run of a single color is made solid instead since it's the same draw with less to read
+//outputs the number of ops put in ops
+int plan_spans_greedy(const int16_t* line_pixels, int seg_start, int seg_end, struct span_op* ops) {
+    int num_ops = 0;
+    int literal_start = seg_start;
+    int color_start = seg_start;
+    for (int pixel_num = seg_start+1; pixel_num <= seg_end+1; pixel_num++) {
+        if (pixel_num <= seg_end && line_pixels[pixel_num] == line_pixels[color_start])
+            continue;
+        bool whole_stretch = color_start == seg_start && pixel_num == seg_end+1;
+        if (pixel_num-color_start >= solid_span_min || whole_stretch) {
+            if (literal_start < color_start) {
+                ops[num_ops].start = literal_start;
+                ops[num_ops].end = color_start-1;
+                ops[num_ops].solid = false;
+                num_ops++;
+            }
+            ops[num_ops].start = color_start;
+            ops[num_ops].end = pixel_num-1;
+            ops[num_ops].solid = true;
+            num_ops++;
+            literal_start = pixel_num;
+        }
+        color_start = pixel_num;
+    }
+    if (literal_start <= seg_end) {
+        ops[num_ops].start = literal_start;
+        ops[num_ops].end = seg_end;
+        ops[num_ops].solid = false;
+        num_ops++;
+    }
+    //single colored literal runs are drawn as solids
+    for (int i = 0; i < num_ops; i++) {
+        if (ops[i].solid)
+            continue;
+        int pixel_num = ops[i].start+1;
+        while (pixel_num <= ops[i].end && line_pixels[pixel_num] == line_pixels[ops[i].start])
+            pixel_num++;
+        ops[i].solid = pixel_num > ops[i].end;
+    }
+    return num_ops;
+}
+
+//Rough timings of what the player does to draw an .arf, so encode 4 can plan the ops that draw the fastest.
+//The strobe counts come from LCDWIKI_KBV: Set_Addr_Window is two Push_Command calls (a command word plus 4 
+//data bytes each) and then the RAMWR command. Every pixel is one writeData16 (two strobes on an 8 bit bus)
+struct bus_cost_model {
+    const char* name;
+    int strobe_ns;        //one write strobe on the display bus
+    int strobes_per_word; //strobes to put out 16 bits: 1 on a 16 bit bus, 2 on an 8 bit bus
+    int call_ns;          //overhead of one LCDWIKI_KBV draw call (chip select, clipping, the call itself)
+    int sd_read_ns;       //overhead of one File.read call
+    int sd_byte_ns;       //each byte read from the SD card
+};
+//Tune these to the board. They only change which ops encode 4 picks, never what ends up on the screen. The ARF 
+//Emulator estimates draw times with a copy of this table (bus_timings in emulator.cpp), keep the two in step
+const struct bus_cost_model bus_models[] = {
+    //name       strobe  per word  call   sd read  sd byte
+    {"mega16",   250,    1,        3000,  6000,    900}, //Arduino Mega with the 16 bit breakout (PORTA/PORTC)
+    {"shield8",  375,    2,        3000,  6000,    900}, //Arduino Mega/Uno with the 8 bit shield
+    {"sam3x",    120,    1,        600,   1500,    150}, //Arduino Due, 16 bit, bits shuffled across the PIO ports
+};
+#define num_bus_models (int)(sizeof(bus_models)/sizeof(bus_models[0]))
+#define default_bus_model 0
+
+//Finds the bus model called name. Returns NULL when there isn't one
+const struct bus_cost_model* find_bus_model(const char* name) {
+    for (int i = 0; i < num_bus_models; i++) {
+        if (strcmp(bus_models[i].name, name) == 0)
+            return &bus_models[i];
+    }
+    return NULL;
+}
+
+enum span_plan {plan_optimal, plan_greedy};
+//What the player spends on each encode 4 op, in nanoseconds. What it takes to start the op and then each pixel in it
+struct span_planner {
+    enum span_plan plan;
+    int solid_open;    //reading [start, length] and the color, then Fill_Rect's call and window
+    int solid_pixel;
+    int literal_open;  //reading [start, -length] and starting the color read, Set_Addr_Window and Push_Any_Color
+    int literal_pixel; //pushing the pixel plus reading its 2 bytes
+};
+
+//With bus_stream the ops are planned for encode 6, where the player doesn't make a call or a read per op. An op 
+//reads its window (up to 7 words), its tag and its color or pixels, a chunk at a time
+void span_planner_init(struct span_planner* planner, enum span_plan plan, const struct bus_cost_model* bus, bool bus_stream) {
+    int window_ns = (2*bus->strobes_per_word + 8 + 1)*bus->strobe_ns;
+    int pixel_ns = bus->strobes_per_word*bus->strobe_ns;
+    planner->plan = plan;
+    if (bus_stream) {
+        planner->solid_open = 18*bus->sd_byte_ns + window_ns;
+        planner->solid_pixel = pixel_ns;
+        planner->literal_open = 16*bus->sd_byte_ns + window_ns;
+        planner->literal_pixel = pixel_ns + 2*bus->sd_byte_ns;
+        return;
+    }
+    planner->solid_open = 2*bus->sd_read_ns + 6*bus->sd_byte_ns + bus->call_ns + window_ns;
+    planner->solid_pixel = pixel_ns;
+    planner->literal_open = 2*bus->sd_read_ns + 4*bus->sd_byte_ns + 2*bus->call_ns + window_ns;
+    planner->literal_pixel = pixel_ns + 2*bus->sd_byte_ns;
+}
+
+#define no_plan_cost 0x3fffffff
+enum span_choice {choice_skip, choice_literal, choice_solid, choice_continue, choice_open};
+//Plans the cheapest ops for the changes on one line between first_changed and last_changed (inclusive) with 
+//the planner's costs. Each pixel is either skipped (only when it didn't change), pushed in a literal op or in 
+//a solid op (which has to stay one color). Going along the line, it keeps the cheapest way to have covered 
+//every change so far three ways: with no op open, with a literal op open or with a solid op open. Then it 
+//walks back through the choices to get the ops
+//outputs the number of ops put in ops
+int plan_spans_optimal(const int16_t* line_pixels, const bool* pixel_changed, int first_changed, int last_changed, 
+                       const struct span_planner* planner, struct span_op* ops) {
+    //indexed by pixel_num+1: the cost once pixel_num is covered
+    int closed_cost[s_height+1], literal_cost[s_height+1], solid_cost[s_height+1];
+    unsigned char closed_choice[s_height+1], literal_choice[s_height+1], solid_choice[s_height+1];
+    closed_cost[first_changed] = 0;
+    literal_cost[first_changed] = no_plan_cost;
+    solid_cost[first_changed] = no_plan_cost;
+    for (int pixel_num = first_changed; pixel_num <= last_changed; pixel_num++) {
+        int next = pixel_num+1;
+        int open_cost = closed_cost[pixel_num] + planner->literal_open;
+        literal_choice[next] = literal_cost[pixel_num] <= open_cost ? choice_continue : choice_open;
+        literal_cost[next] = (literal_choice[next] == choice_continue ? literal_cost[pixel_num] : open_cost) + planner->literal_pixel;
+
+        open_cost = closed_cost[pixel_num] + planner->solid_open;
+        bool same_color = pixel_num > first_changed && line_pixels[pixel_num] == line_pixels[pixel_num-1];
+        solid_choice[next] = same_color && solid_cost[pixel_num] <= open_cost ? choice_continue : choice_open;
+        solid_cost[next] = (solid_choice[next] == choice_continue ? solid_cost[pixel_num] : open_cost) + planner->solid_pixel;
+
+        //prefer skipping, then solid (less to read) on ties
+        closed_choice[next] = choice_skip;
+        closed_cost[next] = pixel_changed[pixel_num] ? no_plan_cost : closed_cost[pixel_num];
+        if (solid_cost[next] < closed_cost[next]) {
+            closed_choice[next] = choice_solid;
+            closed_cost[next] = solid_cost[next];
+        }
+        if (literal_cost[next] < closed_cost[next]) {
+            closed_choice[next] = choice_literal;
+            closed_cost[next] = literal_cost[next];
+        }
+    }
+    //walk the choices back from the end of the line, the ops come out last to first
+    int num_ops = 0;
+    int state = choice_skip;
+    int op_end = 0;
+    for (int next = last_changed+1; next > first_changed; next--) {
+        if (state == choice_skip) {
+            state = closed_choice[next];
+            op_end = next-1;
+            if (state == choice_skip)
+                continue;
+        }
+        unsigned char choice = state == choice_literal ? literal_choice[next] : solid_choice[next];
+        if (choice == choice_open) {
+            ops[num_ops].start = next-1;
+            ops[num_ops].end = op_end;
+            ops[num_ops].solid = state == choice_solid;
+            num_ops++;
+            state = choice_skip;
+        }
+    }
+    for (int i = 0; i < num_ops/2; i++) {
+        struct span_op temp_op = ops[i];
+        ops[i] = ops[num_ops-1-i];
+        ops[num_ops-1-i] = temp_op;
+    }
+    return num_ops;
+}
+
+//Encode 4 for a single direction. Each line that changed gets a header [line location, num ops] and then its ops.
+//A solid op is [start, length, color] and is drawn with Fill_Rect. A literal op is [start, -length] followed 
+//by length colors and is drawn by opening a window and pushing the pixels. The optimal plan picks the ops with 
+//the lowest predicted draw time for the bus. The greedy plan treats changed runs with a gap small enough that 
+//re-sending the unchanged pixels is cheaper than opening another window as one stretch and splits out long solids.
+//For rows the line location is y and the starts are x locations. For columns it's the other way around
+template <class traversal>
+int encode4_frame(const int16_t* curr_pixels, const struct frame_diff* diff, const struct span_planner* planner, struct ARF_writer* output_arf) {
+    static_assert(!traversal::pixels_reversed, "encode 4 ops always go from the start of the line to the end");
+    int16_t line_buff[traversal::line_len];
+    bool pixel_changed[traversal::line_len];
+    struct span_op ops[traversal::line_len];
+    int num_entries = 0;
+    for (int line_step = 0; line_step < traversal::num_lines; line_step++) {
+        const int line_num = traversal::line_num(line_step);
+        if (!traversal::line_changed(diff, line_num))
+            continue;
+        //the planner works on the line as contiguous pixels, so strided columns are gathered first
+        const int16_t* line_pixels = curr_pixels + line_num*traversal::line_stride;
+        if (!traversal::lines_contiguous) {
+            for (int pixel_num = 0; pixel_num < traversal::line_len; pixel_num++)
+                line_buff[pixel_num] = line_pixels[pixel_num*traversal::pixel_stride];
+            line_pixels = line_buff;
+        }
+        int num_ops = 0;
+        int pixel_num = 0, run_start, run_end;
+        bool have_run = next_line_run<traversal>(diff, line_num, &pixel_num, &run_start, &run_end);
+        if (planner->plan == plan_greedy) {
+            while (have_run) {
+                int seg_start = run_start, seg_end = run_end-1;
+                while ((have_run = next_line_run<traversal>(diff, line_num, &pixel_num, &run_start, &run_end)) && 
+                       (run_start-seg_end-1)*(1+literal_pixel_cost) < window_cost)
+                    seg_end = run_end-1;
+                num_ops += plan_spans_greedy(line_pixels, seg_start, seg_end, ops + num_ops);
+            }
+        }
+        else if (have_run) {
+            int first_changed = run_start, last_changed = run_start;
+            int marked_to = run_start;
+            do {
+                while (marked_to < run_start)
+                    pixel_changed[marked_to++] = false;
+                while (marked_to < run_end)
+                    pixel_changed[marked_to++] = true;
+                last_changed = run_end-1;
+            } while (next_line_run<traversal>(diff, line_num, &pixel_num, &run_start, &run_end));
+            num_ops = plan_spans_optimal(line_pixels, pixel_changed, first_changed, last_changed, planner, ops);
+        }
+        int16_t line_header[2] = {(int16_t)line_num, (int16_t)num_ops};
+        arf_write(output_arf, line_header, sizeof(line_header));
+        for (int i = 0; i < num_ops; i++) {
+            int16_t op_len = ops[i].end-ops[i].start+1;
+            if (ops[i].solid) {
+                int16_t solid_op[3] = {(int16_t)ops[i].start, op_len, line_pixels[ops[i].start]};
+                arf_write(output_arf, solid_op, sizeof(solid_op));
+            }
+            else {
+                int16_t literal_op[2] = {(int16_t)ops[i].start, (int16_t)-op_len};
+                arf_write(output_arf, literal_op, sizeof(literal_op));
+                arf_write(output_arf, line_pixels + ops[i].start, op_len*sizeof(int16_t));
+            }
+        }
+        num_entries++;
+    }
+    return num_entries;
+}
+
+//loads the output binary file with the pixels different between the last slide and current slide
+//outputs the number of entries into the file (actual file size is entries*6bytes+6)
+//uses the encoding type 1. Only walks the changed pixels found in diff
+//curr_pixels is in the same layout as diff (transposed when diff->transposed)
+int load_arf_encode1(const int16_t* curr_pixels, enum draw_direction draw_dir, struct frame_diff* diff, struct ARF_writer* output_arf){
+    switch(draw_dir) {
+        case up:
+            return encode1_frame<traverse_up>(curr_pixels, diff, output_arf);
+        case down:
+            return encode1_frame<traverse_down_by_pixel>(curr_pixels, diff, output_arf);
+        case left: 
+            if (diff->transposed)
+                return encode1_frame<traverse_left_transposed>(curr_pixels, diff, output_arf);
+            return encode1_frame<traverse_left>(curr_pixels, diff, output_arf);
+        case right: 
+            if (diff->transposed)
+                return encode1_frame<traverse_right_transposed>(curr_pixels, diff, output_arf);
+            return encode1_frame<traverse_right>(curr_pixels, diff, output_arf);
+        case invalid: 
+            fprintf(stderr, "Invalid direction\n");
+        break;
+    }
+    return 0;
+}
+
+//loads the output binary file with the pixels different between the last slide and current slide
+//outputs the number of entries into the file (entries are variable size, but its size is specified per line)
+//uses the encoding type 2
+int load_arf_encode2(const int16_t* curr_pixels, enum draw_direction draw_dir, struct frame_diff* diff, struct ARF_writer* output_arf){
+    switch(draw_dir) {
+        case up:
+            return encode2_frame<traverse_up>(curr_pixels, diff, output_arf);
+        case down:
+            return encode2_frame<traverse_down>(curr_pixels, diff, output_arf);
+        case left: 
+            if (diff->transposed)
+                return encode2_frame<traverse_left_transposed>(curr_pixels, diff, output_arf);
+            return encode2_frame<traverse_left>(curr_pixels, diff, output_arf);
+        case right: 
+            if (diff->transposed)
+                return encode2_frame<traverse_right_transposed>(curr_pixels, diff, output_arf);
+            return encode2_frame<traverse_right>(curr_pixels, diff, output_arf);
+        case invalid: 
+            fprintf(stderr, "Invalid direction\n");
+        break;
+    }
+    return 0;
+}
+
+//loads the output binary file with the pixels different between the last slide and current slide
+//outputs the number of entries (rectangles) into the file, each one 8 bytes plus 2 bytes per pixel inside it
+//uses the encoding type 3
+int load_arf_encode3(const int16_t* curr_pixels, enum draw_direction draw_dir, struct frame_diff* diff, struct ARF_writer* output_arf){
+    switch(draw_dir) {
+        case up:
+            return encode3_frame<traverse_up>(curr_pixels, diff, output_arf);
+        case down:
+            return encode3_frame<traverse_down>(curr_pixels, diff, output_arf);
+        case left: 
+            if (diff->transposed)
+                return encode3_frame<traverse_left_transposed>(curr_pixels, diff, output_arf);
+            return encode3_frame<traverse_left>(curr_pixels, diff, output_arf);
+        case right: 
+            if (diff->transposed)
+                return encode3_frame<traverse_right_transposed>(curr_pixels, diff, output_arf);
+            return encode3_frame<traverse_right>(curr_pixels, diff, output_arf);
+        case invalid: 
+            fprintf(stderr, "Invalid direction\n");
+        break;
+    }
+    return 0;
+}
+
+//loads the output binary file with the pixels different between the last slide and current slide
+//outputs the number of entries (lines) into the file, each with a 4 byte header and its solid/literal ops
+//uses the encoding type 4
+int load_arf_encode4(const int16_t* curr_pixels, enum draw_direction draw_dir, struct frame_diff* diff, const struct span_planner* planner, struct ARF_writer* output_arf){
+    switch(draw_dir) {
+        case up:
+            return encode4_frame<traverse_up>(curr_pixels, diff, planner, output_arf);
+        case down:
+            return encode4_frame<traverse_down>(curr_pixels, diff, planner, output_arf);
+        case left: 
+            if (diff->transposed)
+                return encode4_frame<traverse_left_transposed>(curr_pixels, diff, planner, output_arf);
+            return encode4_frame<traverse_left>(curr_pixels, diff, planner, output_arf);
+        case right: 
+            if (diff->transposed)
+                return encode4_frame<traverse_right_transposed>(curr_pixels, diff, planner, output_arf);
+            return encode4_frame<traverse_right>(curr_pixels, diff, planner, output_arf);
+        case invalid: 
+            fprintf(stderr, "Invalid direction\n");
+        break;
+    }
+    return 0;
+}
+
+//The ILI9486 commands encode 6 writes. The window's start and end go out as the command's 4 parameter bytes
+#define bus_caset 0x2A //column address set (x)
+#define bus_paset 0x2B //page address set (y)
+#define bus_ramwr 0x2C //memory write, the data words after it fill the window
+#define bus_command_tag 0x8000 //a command on its own
+#define bus_address_tag 0xC000 //a command and the window's start and end words
+#define bus_repeat_tag 0x4000  //the next word sent (tag & bus_run_max) times
+#define bus_run_max 0x3FFF     //the next n words, for a tag under bus_repeat_tag
+//Compiles encode 4's ops (an encode 4 .arf) into what the player writes to the display bus, so it doesn't decode 
+//anything: each op becomes CASET and PASET (left out when that side of the window is the same as the last op's), 
+//RAMWR and the pixels. Outputs the number of words written to stream_out
+int compile_bus_stream(const struct ARF_writer* encode4_arf, enum draw_direction draw_dir, struct ARF_writer* stream_out) {
+    const char* arf_pos = encode4_arf->buffer;
+    int num_lines;
+    memcpy(&num_lines, arf_pos+0x2, sizeof(int));
+    arf_pos += 0x8;
+    size_t stream_start = stream_out->length;
+    //the window isn't known at the start of the file
+    int16_t last_window[4] = {-1, -1, -1, -1};
+    bool lines_are_rows = draw_dir == up || draw_dir == down;
+    for (int i = 0; i < num_lines; i++) {
+        int16_t line_header[2];
+        memcpy(line_header, arf_pos, sizeof(line_header));
+        arf_pos += sizeof(line_header);
+        for (int op_num = 0; op_num < line_header[1]; op_num++) {
+            int16_t op[2];
+            memcpy(op, arf_pos, sizeof(op));
+            arf_pos += sizeof(op);
+            int16_t op_length = op[1] > 0 ? op[1] : -op[1];
+            //[x0, y0, x1, y1]
+            int16_t window[4] = {op[0], line_header[0], (int16_t)(op[0]+op_length-1), line_header[0]};
+            if (!lines_are_rows) {
+                window[0] = line_header[0];
+                window[1] = op[0];
+                window[2] = line_header[0];
+                window[3] = (int16_t)(op[0]+op_length-1);
+            }
+            uint16_t stream_words[3];
+            if (window[0] != last_window[0] || window[2] != last_window[2]) {
+                stream_words[0] = bus_address_tag | bus_caset;
+                stream_words[1] = window[0];
+                stream_words[2] = window[2];
+                arf_write(stream_out, stream_words, 3*sizeof(uint16_t));
+            }
+            if (window[1] != last_window[1] || window[3] != last_window[3]) {
+                stream_words[0] = bus_address_tag | bus_paset;
+                stream_words[1] = window[1];
+                stream_words[2] = window[3];
+                arf_write(stream_out, stream_words, 3*sizeof(uint16_t));
+            }
+            memcpy(last_window, window, sizeof(window));
+            stream_words[0] = bus_command_tag | bus_ramwr;
+            arf_write(stream_out, stream_words, sizeof(uint16_t));
+            //a line is never longer than bus_run_max, so one tag covers the op
+            if (op[1] > 0) {
+                stream_words[0] = bus_repeat_tag | op_length;
+                memcpy(&stream_words[1], arf_pos, sizeof(uint16_t));
+                arf_write(stream_out, stream_words, 2*sizeof(uint16_t));
+                arf_pos += sizeof(uint16_t);
+            }
+            else {
+                stream_words[0] = op_length;
+                arf_write(stream_out, stream_words, sizeof(uint16_t));
+                arf_write(stream_out, arf_pos, op_length*sizeof(uint16_t));
+                arf_pos += op_length*sizeof(uint16_t);
+            }
+        }
+    }
+    return (stream_out->length - stream_start)/sizeof(uint16_t);
+}
+
+//load the arf file with the number of entries in the file. Used to know when at the end of the file
+void load_arf_num_entries(struct ARF_writer* arf_out, int num_entries) {
+    arf_patch(arf_out, 0x2, &num_entries, sizeof(int));
+}
+//What --report records for one frame pair. The pair's curr frame brings its load times, so every frame is 
+//counted once (the first frame with the loop pair)
+struct pair_report {
+    bool encoded; //false when --dedup found the pair earlier, so none of the rest is filled in
+    bool from_cache;
+    char file_name[512]; //without the output directory
+    const char* last_file;
+    const char* curr_file;
+    enum draw_direction draw_dir;
+    int num_entries;
+    size_t num_bytes;
+    int changed_pixels;
+    int changed_rows;
+    int num_spans; //the runs of changed pixels along the changed rows
+    int16_t bounds[4]; //x0, y0, x1, y1 of the changed pixels, inclusive. -1 when nothing changed
+    double stage_ms[num_stages];
+};
+
+//--report: every pair's stats and stage times, written out as JSON (or CSV for a .csv file) once the animation is done
+struct encode_report {
+    char* report_file;
+    char* setup_file;
+    int num_pairs;
+    struct pair_report* pairs; //pair N is pairs[N-1], the loop pair is last
+    double parse_ms;
+    double start_ms;
+};
+
+//The settings from the command line that change how the frames get encoded
+struct compress_options {
+    char encode_type;
+    int num_threads;
+    bool transpose_columns; //transpose the frames before encoding left/right so the columns are contiguous
+    enum rotate horizontal_rotate; //how horizontal frames are turned upright
+    bool dedup; //skip repeated frame pairs and share identical .arf files through a manifest
+    char* cache_dir; //the .arf cache folder (inside the output folder), NULL when --cache is off
+    struct span_planner planner; //encode 4's costs for the --bus board and the --plan
+    bool use_palette; //--palette: index the colors when the animation has few enough of them
+    int tolerance; //--tolerance: per channel color difference from the shown frame that counts as unchanged (0 is exact)
+    const struct arf_palette* palette; //the animation's palette, NULL when the colors stay direct
+    bool sector_align; //--sector-align: lay encodes 1 and 2 out in 512 byte SD card sectors
+    bool pack; //--pack: put the animation's .arf files into one animation.pak once they're written
+    struct encode_report* report; //--report: where each pair's stats go, NULL when it's off
+};
+
+//Everything a thread needs to encode frames. The buffers are kept between frames so they're only allocated once
+struct encode_workspace {
+    struct ARF_writer arf_out;
+    struct ARF_writer arf_indexed; //arf_out rewritten with palette indices, then swapped in
+    struct frame_diff diff;
+    int16_t* transposed_pixels[2]; //column major copies of the last and curr frames for left/right
+};
+
+void encode_workspace_init(struct encode_workspace* workspace) {
+    arf_writer_init(&workspace->arf_out);
+    arf_writer_init(&workspace->arf_indexed);
+    frame_diff_init(&workspace->diff);
+    workspace->transposed_pixels[0] = NULL;
+    workspace->transposed_pixels[1] = NULL;
+}
+
+void encode_workspace_free(struct encode_workspace* workspace) {
+    arf_writer_free(&workspace->arf_out);
+    arf_writer_free(&workspace->arf_indexed);
+    frame_diff_free(&workspace->diff);
+    free(workspace->transposed_pixels[0]);
+    free(workspace->transposed_pixels[1]);
+}
+
+//Diffs the frames into the workspace and returns the curr pixels in the layout the diff was made in
+//left/right get transposed first (if enabled) so their columns are walked as contiguous lines
+const int16_t* diff_frame_pair(const int16_t* last_pixels, const int16_t* curr_pixels, enum draw_direction draw_dir, bool transpose_columns, struct encode_workspace* workspace) {
+    if (transpose_columns && (draw_dir == left || draw_dir == right)) {
+        for (int i = 0; i < 2; i++) {
+            if (workspace->transposed_pixels[i] == NULL)
+                workspace->transposed_pixels[i] = (int16_t*)malloc(s_width*s_height*sizeof(int16_t));
+        }
+        transpose_pixels(last_pixels, s_height, s_width, workspace->transposed_pixels[0]);
+        transpose_pixels(curr_pixels, s_height, s_width, workspace->transposed_pixels[1]);
+        diff_frames(workspace->transposed_pixels[0], workspace->transposed_pixels[1], s_width, s_height, &workspace->diff);
+        workspace->diff.transposed = true;
+        return workspace->transposed_pixels[1];
+    }
+    diff_frames(last_pixels, curr_pixels, s_height, s_width, &workspace->diff);
+    return curr_pixels;
+}
+
+//Runs the encoder for encode_type into arf_out (after the header). Returns the number of entries
+int encode_frame_pair(const int16_t* curr_pixels, enum draw_direction draw_dir, char encode_type, const struct span_planner* planner, struct encode_workspace* workspace) {
+    switch(encode_type) {
         case 1:
-            num_entries = load_arf_encode1(last_BMP, curr_BMP, output_file);
-        break; 
+            return load_arf_encode1(curr_pixels, draw_dir, &workspace->diff, &workspace->arf_out);
         case 2:
-            num_entries = load_arf_encode2(last_BMP, curr_BMP, output_file);
+            return load_arf_encode2(curr_pixels, draw_dir, &workspace->diff, &workspace->arf_out);
+        case 3:
+            return load_arf_encode3(curr_pixels, draw_dir, &workspace->diff, &workspace->arf_out);
+        case 4:
+            return load_arf_encode4(curr_pixels, draw_dir, &workspace->diff, planner, &workspace->arf_out);
+        case 6: {
+            //the ops are planned as encode 4 in the spare buffer, then compiled into the bus stream
+            setup_arf(&workspace->arf_indexed, draw_dir, 4);
+            int num_lines = load_arf_encode4(curr_pixels, draw_dir, &workspace->diff, planner, &workspace->arf_indexed);
+            load_arf_num_entries(&workspace->arf_indexed, num_lines);
+            return compile_bus_stream(&workspace->arf_indexed, draw_dir, &workspace->arf_out);
+        }
+    }
+    return 0;
+}
+
+#define fnv1a_64_offset 0xcbf29ce484222325ULL
+#define fnv1a_64_prime 0x100000001b3ULL
+//64-bit FNV-1a hash of len bytes, continuing on from hash (start with fnv1a_64_offset)
+uint64_t fnv1a_64(const void* data, size_t len, uint64_t hash) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= fnv1a_64_prime;
+    }
+    return hash;
+}
+
+//What files2arf wrote, so that identical .arf files can be found later
+struct arf_digest {
+    char file_name[512]; //without the output directory
+    uint64_t hash;
+    size_t length;
+    int num_entries;
+    bool from_cache;
+};
+
+#define palette_max_colors 256
+#define palette_flag 0x80        //set on the encode type byte when the colors are palette indices
+#define palette_nibble_flag 0x40 //set as well when the indices are 4 bits (16 colors or less)
+#define palette_file_name "palette.pal"
+#define no_palette_index 0xFFFF
+//The colors used across a whole animation. With 256 or less, the .arf files hold an index into them in 
+//place of every color: one byte for single colors, 4 or 8 bits each for the pixel arrays of encodes 3 and 4
+struct arf_palette {
+    int num_colors; //keeps counting past palette_max_colors so it's known the animation doesn't fit
+    int index_bits; //4 or 8
+    uint16_t colors[palette_max_colors];
+    uint16_t* color_index; //the index of every r5g6b5 color, no_palette_index when it isn't used
+    uint64_t hash;
+};
+
+bool arf_palette_init(struct arf_palette* palette) {
+    palette->num_colors = 0;
+    palette->index_bits = 8;
+    palette->hash = 0;
+    palette->color_index = (uint16_t*)malloc(65536*sizeof(uint16_t));
+    if (palette->color_index == NULL) {
+        fprintf(stderr, "ERROR, Couldn't allocate the palette\n");
+        return false;
+    }
+    memset(palette->color_index, 0xFF, 65536*sizeof(uint16_t));
+    return true;
+}
+
+void arf_palette_free(struct arf_palette* palette) {
+    free(palette->color_index);
+    palette->color_index = NULL;
+}
+
+//Adds every color in the frame to the palette
+void arf_palette_add_frame(struct arf_palette* palette, const struct BMP_attributes* frame) {
+    const uint16_t* pixels = (const uint16_t*)frame->BMP_pixel_array;
+    for (int i = 0; i < s_width*s_height && palette->num_colors <= palette_max_colors; i++) {
+        if (palette->color_index[pixels[i]] == no_palette_index)
+            palette->color_index[pixels[i]] = palette->num_colors++;
+    }
+}
+
+//Numbers the colors in order (so the palette doesn't depend on the order the frames were added in), picks 
+//the index size and writes the palette next to the .arf files. The player keeps it in SRAM
+//returns false when there are too many colors (the .arf files keep their direct colors) or it couldn't be written
+bool arf_palette_finish(struct arf_palette* palette, char* output_dir, FILE* log_file) {
+    char palette_file_str[512];
+    char palette_name[] = palette_file_name;
+    file_name2output_dir(palette_file_str, palette_name, output_dir);
+    if (palette->num_colors > palette_max_colors) {
+        fprintf(log_file, "Palette: more than %d colors, keeping direct color\n", palette_max_colors);
+        //don't leave an old run's palette next to .arf files that don't use it
+        remove(palette_file_str);
+        return false;
+    }
+    palette->num_colors = 0;
+    for (int color = 0; color < 65536; color++) {
+        if (palette->color_index[color] != no_palette_index) {
+            palette->colors[palette->num_colors] = color;
+            palette->color_index[color] = palette->num_colors++;
+        }
+    }
+    palette->index_bits = palette->num_colors <= 16 ? 4 : 8;
+    palette->hash = fnv1a_64(palette->colors, palette->num_colors*sizeof(uint16_t), fnv1a_64_offset);
+    palette->hash = fnv1a_64(&palette->index_bits, sizeof(int), palette->hash);
+
+    //"PL", number of colors (2 bytes), index bits (1 byte), a spare byte, then the colors
+    struct ARF_writer palette_out;
+    arf_writer_init(&palette_out);
+    char palette_title[2] = {'P', 'L'};
+    arf_write(&palette_out, palette_title, sizeof(palette_title));
+    uint16_t num_colors = palette->num_colors;
+    arf_write(&palette_out, &num_colors, sizeof(num_colors));
+    unsigned char palette_settings[2] = {(unsigned char)palette->index_bits, 0};
+    arf_write(&palette_out, palette_settings, sizeof(palette_settings));
+    arf_write(&palette_out, palette->colors, palette->num_colors*sizeof(uint16_t));
+    bool written = arf_writer_flush(&palette_out, palette_file_str);
+    arf_writer_free(&palette_out);
+    if (!written) {
+        fprintf(stderr, "ERROR, Failed to create file [%s]\n", palette_file_str);
+        return false;
+    }
+    fprintf(log_file, "Palette: %d colors, %d bit indices\n", palette->num_colors, palette->index_bits);
+    return true;
+}
+
+//Writes a single color (read from an encoded .arf) out as its palette index, always a whole byte
+void arf_write_index(struct ARF_writer* indexed_out, const char* color_ptr, const struct arf_palette* palette) {
+    uint16_t color;
+    memcpy(&color, color_ptr, sizeof(uint16_t));
+    unsigned char color_index = (unsigned char)palette->color_index[color];
+    arf_write(indexed_out, &color_index, sizeof(color_index));
+}
+
+//Writes count colors (read from an encoded .arf) out as palette indices. 4 bit indices are packed two to 
+//a byte, the first in the high nibble, and an odd count is padded out to a whole byte
+void arf_write_indices(struct ARF_writer* indexed_out, const char* colors, int count, const struct arf_palette* palette) {
+    unsigned char index_buff[512];
+    int pixels_per_chunk = palette->index_bits == 4 ? 2*sizeof(index_buff) : sizeof(index_buff);
+    while (count > 0) {
+        int chunk_count = count < pixels_per_chunk ? count : pixels_per_chunk;
+        for (int i = 0; i < chunk_count; i++) {
+            uint16_t color;
+            memcpy(&color, colors + i*sizeof(uint16_t), sizeof(uint16_t));
+            unsigned char color_index = (unsigned char)palette->color_index[color];
+            if (palette->index_bits == 8)
+                index_buff[i] = color_index;
+            else if (i % 2 == 0)
+                index_buff[i/2] = color_index << 4;
+            else
+                index_buff[i/2] |= color_index;
+        }
+        arf_write(indexed_out, index_buff, palette->index_bits == 8 ? chunk_count : (chunk_count+1)/2);
+        colors += chunk_count*sizeof(uint16_t);
+        count -= chunk_count;
+    }
+}
+
+//Rewrites the encoded .arf in arf_out into indexed_out with palette indices in place of its colors, 
+//and sets the palette flags on the encode type. Single colors become a byte, pixel arrays are packed
+void arf_index_colors(const struct ARF_writer* arf_out, const struct arf_palette* palette, struct ARF_writer* indexed_out) {
+    const char* arf_pos = arf_out->buffer;
+    int num_entries;
+    memcpy(&num_entries, arf_pos+0x2, sizeof(int));
+    char encode_type = arf_pos[0x7];
+    arf_writer_reset(indexed_out);
+    arf_write(indexed_out, arf_pos, 0x7);
+    char indexed_type = encode_type | palette_flag | (palette->index_bits == 4 ? palette_nibble_flag : 0);
+    arf_write(indexed_out, &indexed_type, sizeof(char));
+    arf_pos += 0x8;
+    int16_t entry[4];
+    for (int i = 0; i < num_entries; i++) {
+        switch(encode_type) {
+            case 1: //[x, y, color] -> [x, y, index]
+                arf_write(indexed_out, arf_pos, 2*sizeof(int16_t));
+                arf_write_index(indexed_out, arf_pos+4, palette);
+                arf_pos += 3*sizeof(int16_t);
+            break;
+            case 2: //[line, count] then count [color, start, end] -> [index, start, end]
+                memcpy(entry, arf_pos, 2*sizeof(int16_t));
+                arf_write(indexed_out, entry, 2*sizeof(int16_t));
+                arf_pos += 2*sizeof(int16_t);
+                for (int line_entry = 0; line_entry < entry[1]; line_entry++) {
+                    arf_write_index(indexed_out, arf_pos, palette);
+                    arf_write(indexed_out, arf_pos+2, 2*sizeof(int16_t));
+                    arf_pos += 3*sizeof(int16_t);
+                }
+            break;
+            case 3: { //[x0, y0, x1, y1] then the rectangle's colors
+                memcpy(entry, arf_pos, 4*sizeof(int16_t));
+                arf_write(indexed_out, entry, 4*sizeof(int16_t));
+                arf_pos += 4*sizeof(int16_t);
+                int num_pixels = (entry[2]-entry[0]+1)*(entry[3]-entry[1]+1);
+                arf_write_indices(indexed_out, arf_pos, num_pixels, palette);
+                arf_pos += num_pixels*sizeof(int16_t);
+            }
+            break;
+            case 4: //[line, count] then count [start, length, color] or [start, -length, colors]
+                memcpy(entry, arf_pos, 2*sizeof(int16_t));
+                arf_write(indexed_out, entry, 2*sizeof(int16_t));
+                arf_pos += 2*sizeof(int16_t);
+                for (int op_num = 0; op_num < entry[1]; op_num++) {
+                    int16_t op[2];
+                    memcpy(op, arf_pos, sizeof(op));
+                    arf_write(indexed_out, op, sizeof(op));
+                    arf_pos += sizeof(op);
+                    if (op[1] > 0) {
+                        arf_write_index(indexed_out, arf_pos, palette);
+                        arf_pos += sizeof(int16_t);
+                    }
+                    else {
+                        arf_write_indices(indexed_out, arf_pos, -op[1], palette);
+                        arf_pos += -op[1]*sizeof(int16_t);
+                    }
+                }
+            break;
+        }
+    }
+}
+
+#define sector_size 512
+#define sector_flag 0x20 //set on the encode type byte when the ops are laid out in SD card sectors
+#define sector_header_size 12 //the usual 8 bytes, then the number of sectors (2 bytes) and 2 spare bytes
+//Adds one op to a sector laid out .arf. An op that doesn't fit in the rest of the sector starts the next one, 
+//the player follows the same rule so there's nothing in the file to mark the gap
+inline void arf_sector_write(struct ARF_writer* sector_out, const void* op, size_t op_size) {
+    static const char sector_padding[sector_size] = {0};
+    size_t sector_left = sector_size - sector_out->length % sector_size;
+    if (op_size > sector_left)
+        arf_write(sector_out, sector_padding, sector_left);
+    arf_write(sector_out, op, op_size);
+}
+
+//Pads the end of arf_out out to a whole sector
+void arf_sector_pad(struct ARF_writer* arf_out) {
+    static const char sector_padding[sector_size] = {0};
+    if (arf_out->length % sector_size != 0)
+        arf_write(arf_out, sector_padding, sector_size - arf_out->length % sector_size);
+}
+
+//Lays an encode 1 or 2 .arf (direct or palette colors) out in 512 byte SD card sectors, so the player can read 
+//it a whole sector at a time and no op is ever split between two sectors. The file is padded to whole sectors
+void arf_sector_align(const struct ARF_writer* arf_out, struct ARF_writer* sector_out) {
+    const char* arf_pos = arf_out->buffer;
+    int num_entries;
+    memcpy(&num_entries, arf_pos+0x2, sizeof(int));
+    char encode_type = arf_pos[0x7];
+    int color_size = (encode_type & palette_flag) ? 1 : 2;
+    arf_writer_reset(sector_out);
+    arf_write(sector_out, arf_pos, 0x7);
+    char sector_type = encode_type | sector_flag;
+    arf_write(sector_out, &sector_type, sizeof(char));
+    uint16_t sector_count[2] = {0, 0}; //filled in at the end, then a spare
+    arf_write(sector_out, sector_count, sizeof(sector_count));
+    arf_pos += 0x8;
+    for (int i = 0; i < num_entries; i++) {
+        switch(encode_type & 0x0F) {
+            case 1: //[x, y, color]
+                arf_sector_write(sector_out, arf_pos, 2*sizeof(int16_t)+color_size);
+                arf_pos += 2*sizeof(int16_t)+color_size;
+            break;
+            case 2: { //[line, count] then count [color, start, end]
+                int16_t line_header[2];
+                memcpy(line_header, arf_pos, sizeof(line_header));
+                arf_sector_write(sector_out, arf_pos, sizeof(line_header));
+                arf_pos += sizeof(line_header);
+                for (int line_entry = 0; line_entry < line_header[1]; line_entry++) {
+                    arf_sector_write(sector_out, arf_pos, color_size+2*sizeof(int16_t));
+                    arf_pos += color_size+2*sizeof(int16_t);
+                }
+            }
+            break;
+        }
+    }
+    arf_sector_pad(sector_out);
+    sector_count[0] = sector_out->length / sector_size;
+    arf_patch(sector_out, 0x8, sector_count, sizeof(uint16_t));
+}
+
+#define arf_cache_folder "arf_cache"
+#define arf_cache_version 1 //change whenever the same frames would encode to different .arf bytes
+//The cache file for a pair is named after a hash of the two frames, the draw direction and the encode type
+//(and for encodes 4 and 6 the planner, since the bus and plan change which ops get picked, the palette when there is one 
+//and the sector layout)
+void arf_cache_file_name(char* cache_file_str, const struct compress_options* options, struct BMP_attributes* last_BMP, struct BMP_attributes* curr_BMP) {
+    uint64_t cache_key = fnv1a_64(&last_BMP->pixel_hash, sizeof(uint64_t), fnv1a_64_offset);
+    cache_key = fnv1a_64(&curr_BMP->pixel_hash, sizeof(uint64_t), cache_key);
+    unsigned char key_settings[3] = {(unsigned char)curr_BMP->animate_dir, (unsigned char)options->encode_type, arf_cache_version};
+    cache_key = fnv1a_64(key_settings, sizeof(key_settings), cache_key);
+    if (options->encode_type == 4 || options->encode_type == 6)
+        cache_key = fnv1a_64(&options->planner, sizeof(struct span_planner), cache_key);
+    if (options->palette != NULL)
+        cache_key = fnv1a_64(&options->palette->hash, sizeof(uint64_t), cache_key);
+    if (options->sector_align)
+        cache_key = fnv1a_64(&options->sector_align, sizeof(bool), cache_key);
+    char cache_file_name[32];
+    sprintf(cache_file_name, "%016llx.arf", (unsigned long long)cache_key);
+    file_name2output_dir(cache_file_str, cache_file_name, options->cache_dir);
+}
+
+//Puts the file at from_file_str in place as to_file_str, with a hard link when possible. When it can't link 
+//(windows, or a file system without links) it writes out arf_out, which holds the same bytes
+bool arf_cache_place(struct ARF_writer* arf_out, const char* from_file_str, const char* to_file_str) {
+    remove(to_file_str);
+#if use_hard_links
+    if (link(from_file_str, to_file_str) == 0)
+        return true;
+#endif
+    return arf_writer_flush(arf_out, to_file_str);
+}
+
+//Loads the cached .arf into arf_out and puts it in place as the output file
+//Returns false when the pair isn't in the cache (or the cached file is broken), then it has to be encoded
+bool arf_cache_fetch(struct ARF_writer* arf_out, const char* cache_file_str, const char* output_file_str) {
+    FILE* cache_file = fopen(cache_file_str, "rb");
+    if (cache_file == NULL)
+        return false;
+    arf_writer_reset(arf_out);
+    char read_buff[4096];
+    size_t bytes_read;
+    while ((bytes_read = fread(read_buff, 1, sizeof(read_buff), cache_file)) > 0)
+        arf_write(arf_out, read_buff, bytes_read);
+    fclose(cache_file);
+    if (arf_out->length < 8 || arf_out->buffer[0] != 'A' || arf_out->buffer[1] != 'R')
+        return false;
+    return arf_cache_place(arf_out, cache_file_str, output_file_str);
+}
+
+//Taking in BMP attributes, creates the output files and spits out data to them
+//All progress messages go to log_file so that worker threads can keep their output in order
+//The frame is built up in the workspace's arf_out and written to the file in one go. If digest isn't NULL it 
+//gets filled in with the file's name and a hash of its bytes
+int files2arf(struct BMP_attributes* last_BMP, struct BMP_attributes* curr_BMP, char* output_dir, int file_count, const struct compress_options* options, struct encode_workspace* workspace, FILE* log_file, struct arf_digest* digest) {
+    struct ARF_writer* arf_out = &workspace->arf_out;
+    char name_of_output_file[512];
+    char output_file_str[512];
+    //First create the name of the output file
+    combine_file_names(name_of_output_file, last_BMP->file_name, curr_BMP->file_name, file_count);
+    file_name2output_dir(output_file_str, name_of_output_file, output_dir);
+    fprintf(log_file, "New File Name: %s\n", output_file_str);
+
+    //With --report, the pair's stats and stage times go into its slot
+    struct pair_report* report = options->report != NULL ? &options->report->pairs[file_count-1] : NULL;
+    double stage_start = time_ms();
+    //With --cache, a pair that was encoded by an earlier run is taken from the cache instead
+    char cache_file_str[512];
+    bool from_cache = false;
+    int num_entries;
+    if (options->cache_dir != NULL) {
+        arf_cache_file_name(cache_file_str, options, last_BMP, curr_BMP);
+        from_cache = arf_cache_fetch(arf_out, cache_file_str, output_file_str);
+    }
+    if (from_cache) {
+        memcpy(&num_entries, arf_out->buffer+0x2, sizeof(int));
+        fprintf(log_file, "Encode %d Count Changes: %d (cached)\n", options->encode_type, num_entries);
+    }
+    else {
+        //Find what changed between the frames once, the encoders only walk the changes
+        const int16_t* curr_pixels = diff_frame_pair(last_BMP->BMP_pixel_array, curr_BMP->BMP_pixel_array, curr_BMP->animate_dir, options->transpose_columns, workspace);
+        if (report != NULL) {
+            report->stage_ms[stage_diff] = time_ms() - stage_start;
+            report->changed_pixels = workspace->diff.total_changes;
+            frame_diff_stats(&workspace->diff, report->bounds, &report->changed_rows, &report->num_spans);
+            stage_start = time_ms();
+        }
+
+        //Load the output file binary
+        setup_arf(arf_out, curr_BMP->animate_dir, options->encode_type);
+        num_entries = encode_frame_pair(curr_pixels, curr_BMP->animate_dir, options->encode_type, &options->planner, workspace);
+        fprintf(log_file, "Encode %d Count Changes: %d\n", options->encode_type, num_entries);
+        load_arf_num_entries(arf_out, num_entries);
+        if (options->palette != NULL) {
+            arf_index_colors(arf_out, options->palette, &workspace->arf_indexed);
+            struct ARF_writer direct_arf = *arf_out;
+            *arf_out = workspace->arf_indexed;
+            workspace->arf_indexed = direct_arf;
+        }
+        if (options->sector_align) {
+            arf_sector_align(arf_out, &workspace->arf_indexed);
+            struct ARF_writer packed_arf = *arf_out;
+            *arf_out = workspace->arf_indexed;
+            workspace->arf_indexed = packed_arf;
+        }
+        if (report != NULL) {
+            report->stage_ms[stage_encode] = time_ms() - stage_start;
+            stage_start = time_ms();
+        }
+
+        //Now, can finally create the output file
+        if (!arf_writer_flush(arf_out, output_file_str)) {
+            fprintf(stderr, "ERROR, Failed to create file [%s]\n", output_file_str);
+            return -1;
+        }
+        if (options->cache_dir != NULL && !arf_cache_place(arf_out, output_file_str, cache_file_str))
+            fprintf(stderr, "Couldn't add [%s] to the cache\n", output_file_str);
+    }
+    if (report != NULL) {
+        //a cached pair's time all goes to fetching the file
+        report->stage_ms[stage_write] = time_ms() - stage_start;
+        report->encoded = true;
+        report->from_cache = from_cache;
+        strcpy(report->file_name, name_of_output_file);
+        report->last_file = last_BMP->file_name;
+        report->curr_file = curr_BMP->file_name;
+        report->draw_dir = curr_BMP->animate_dir;
+        report->num_entries = num_entries;
+        report->num_bytes = arf_out->length;
+        for (int stage = stage_verify; stage <= stage_rotate; stage++)
+            report->stage_ms[stage] = curr_BMP->load_ms[stage];
+    }
+
+    if (digest != NULL) {
+        strcpy(digest->file_name, name_of_output_file);
+        digest->hash = fnv1a_64(arf_out->buffer, arf_out->length, fnv1a_64_offset);
+        digest->length = arf_out->length;
+        digest->num_entries = num_entries;
+        digest->from_cache = from_cache;
+    }
+    return num_entries;
+}
+/**************************************************************************************************************
+ *                 END ARF File Handler
+ **************************************************************************************************************/
+
+//Free the first and last frames back to the pool.
+//The last frame starts out as the first one, so it is only freed once they differ
+void free_BMP_arr(struct BMP_attributes* first_BMP, struct BMP_attributes* last_BMP, struct frame_pool* pool) {
+    if (last_BMP != first_BMP)
+        free_BMP_frame(last_BMP, pool);
+    free_BMP_frame(first_BMP, pool);
+}
+
+//Takes the .bmp header and the new width and height and the pixel array and outputs a .bmp
+void BMP_attr2BMP(BMP_attributes* BMP2Create, char* BMP_file_dir, char* BMP_file_name) {
+    char combined_BMP_file_dir[512];
+    directory_file_combine(combined_BMP_file_dir, BMP_file_dir, BMP_file_name); 
+    FILE* BMP_filep = fopen(combined_BMP_file_dir, "w+");
+    if (BMP_filep == NULL) {
+        fprintf(stderr, "Failed to create the BMP file");
+        return;
+    }
+    //write the last BMP header stored into the new file 
+    fwrite(BMP2Create->BMP_header, 1, BMP2Create->offset, BMP_filep);
+    //Move to where to write the width and height
+    fseek(BMP_filep, 0x12, SEEK_SET); 
+    //replace the size with the updated size. Nothing else should have changed, as the image shouldn't get bigger
+    fwrite(&(BMP2Create->width), sizeof(int), 1, BMP_filep);//write width
+    fwrite(&(BMP2Create->height), sizeof(int), 1, BMP_filep);//write height
+
+    //write out the pixel array
+    fseek(BMP_filep, BMP2Create->offset, SEEK_SET);
+    fwrite(BMP2Create->BMP_pixel_array, sizeof(int16_t), BMP2Create->width*BMP2Create->height, BMP_filep);
+    fclose(BMP_filep);
+    
+}
+
+
+
+//Loads a single frame from its file directory. Verifies the file name and the BMP, then reads in the pixel array
+//Horizontal (480x320) frames are turned upright with horizontal_rotate. Any buffers it needs come from the pool
+//Returns false (with the error printed) if the frame could not be loaded
+bool load_BMP_frame(struct BMP_attributes* BMP_frame, char* file_dir, enum rotate horizontal_rotate, struct frame_pool* pool) {
+    char* temp_extract;
+    memset(BMP_frame, 0, sizeof(struct BMP_attributes));
+    BMP_frame->pool_handle = no_frame_handle;
+    double stage_start = time_ms();
+    //verify the name is a .bmp extension 
+    if ((temp_extract = extract_file_name(file_dir)) == NULL) {
+        return false;
+    }
+    if (!verify_bmp_file_name(temp_extract)) {
+        fprintf(stderr, "ERROR, File Extension isn't exactly (.bmp). Case sensitive\n");
+        return false;
+    }
+    BMP_frame->file_name = temp_extract;
+#if use_mmap_ingest
+    //Map the whole file and validate the header in place. The header and pixel array are views into the map
+    int BMP_fd = open(file_dir, O_RDONLY);
+    struct stat BMP_stat;
+    if (BMP_fd < 0 || fstat(BMP_fd, &BMP_stat) != 0) {
+        fprintf(stderr, "ERROR, Failed to open file [%s]\n", file_dir);
+        if (BMP_fd >= 0)
+            close(BMP_fd);
+        return false;
+    }
+    BMP_frame->BMP_map_size = BMP_stat.st_size;
+    void* BMP_map = mmap(NULL, BMP_frame->BMP_map_size, PROT_READ, MAP_PRIVATE, BMP_fd, 0);
+    close(BMP_fd);
+    if (BMP_map == MAP_FAILED) {
+        fprintf(stderr, "ERROR, Failed to map file [%s]\n", file_dir);
+        return false;
+    }
+    BMP_frame->BMP_map = (char*)BMP_map;
+    //if the file isn't a valid bmp, free
+    if(!verify_bmp(BMP_frame, BMP_frame->BMP_map, BMP_frame->BMP_map_size) || (size_t)BMP_frame->size > BMP_frame->BMP_map_size) {
+        fprintf(stderr, "Exiting Due to Failed BMP...\n");
+        munmap(BMP_frame->BMP_map, BMP_frame->BMP_map_size);
+        BMP_frame->BMP_map = NULL;
+        return false;
+    }
+    BMP_frame->load_ms[stage_verify] = time_ms() - stage_start;
+    stage_start = time_ms();
+    BMP_frame->BMP_header = BMP_frame->BMP_map;
+    if (BMP_frame->offset % sizeof(int16_t) == 0) {
+        BMP_frame->BMP_pixel_array = (int16_t*)(BMP_frame->BMP_map+BMP_frame->offset);
+    }
+    else {
+        //an odd offset can't be used as an int16_t view, so it gets copied into a pool buffer
+        if ((BMP_frame->pool_handle = frame_pool_acquire(pool)) == no_frame_handle) {
+            free_BMP_frame(BMP_frame, pool);
+            return false;
+        }
+        BMP_frame->BMP_pixel_array = frame_pool_pixels(pool, BMP_frame->pool_handle);
+        memcpy(BMP_frame->BMP_pixel_array, BMP_frame->BMP_map+BMP_frame->offset, frame_pixel_bytes);
+    }
+#else
+    BMP_frame->BMP_file = fopen(file_dir, "rb");
+    if (BMP_frame->BMP_file == NULL) {
+        fprintf(stderr, "ERROR, Failed to open file [%s]\n", file_dir);
+        return false;
+    }
+    //read in enough to verify, then the whole header once the offset is known
+    char BMP_min_header[BMP_min_header_bytes];
+    size_t header_read = fread(BMP_min_header, 1, BMP_min_header_bytes, BMP_frame->BMP_file);
+    //if the file isn't a valid bmp, free
+    if(!verify_bmp(BMP_frame, BMP_min_header, header_read)) {
+        fprintf(stderr, "Exiting Due to Failed BMP...\n");
+        fclose(BMP_frame->BMP_file);
+        return false;
+    }
+    if (BMP_frame->offset > frame_header_bytes) {
+        fprintf(stderr, "BMP header is larger than %d bytes\n", frame_header_bytes);
+        fclose(BMP_frame->BMP_file);
+        return false;
+    }
+    if ((BMP_frame->pool_handle = frame_pool_acquire(pool)) == no_frame_handle) {
+        fclose(BMP_frame->BMP_file);
+        return false;
+    }
+    BMP_frame->load_ms[stage_verify] = time_ms() - stage_start;
+    stage_start = time_ms();
+    //load the BMP file header
+    fseek(BMP_frame->BMP_file, 0x0, SEEK_SET); 
+    BMP_frame->BMP_header = frame_pool_header(pool, BMP_frame->pool_handle); 
+    fread(BMP_frame->BMP_header, 1, BMP_frame->offset, BMP_frame->BMP_file);
+    //Fills the values of the BMP pixel array
+    BMP_frame->BMP_pixel_array = frame_pool_pixels(pool, BMP_frame->pool_handle); 
+    fread(BMP_frame->BMP_pixel_array, sizeof(int16_t), s_width*s_height, BMP_frame->BMP_file);
+    //Free up the BMP file
+    fclose(BMP_frame->BMP_file);
+    BMP_frame->BMP_file = NULL;
+#endif
+    //a mapped frame is only paged in once a later stage touches its pixels
+    BMP_frame->load_ms[stage_read] = time_ms() - stage_start;
+    stage_start = time_ms();
+    //top-down frames are flipped into the usual bottom up row order. A mapped frame is read only, so it's 
+    //flipped into a pool buffer instead of in place
+    if (BMP_frame->top_down) {
+        if (BMP_frame->pool_handle == no_frame_handle) {
+            if ((BMP_frame->pool_handle = frame_pool_acquire(pool)) == no_frame_handle) {
+                free_BMP_frame(BMP_frame, pool);
+                return false;
+            }
+            flip_BMP_pixel_arr(BMP_frame, vertical, frame_pool_pixels(pool, BMP_frame->pool_handle));
+        }
+        else
+            flip_BMP_pixel_arr(BMP_frame, vertical, BMP_frame->BMP_pixel_array);
+    }
+    //every frame is encoded as 320x480, so horizontal frames get rotated into place
+    if (BMP_frame->orientation == horizontal) {
+        int rotated_handle = frame_pool_acquire(pool);
+        if (rotated_handle == no_frame_handle) {
+            free_BMP_frame(BMP_frame, pool);
+            return false;
+        }
+        rotate_BMP_pixel_arr(BMP_frame, horizontal_rotate, frame_pool_pixels(pool, rotated_handle));
+        //a read in header moves along with the pixels
+        if (BMP_frame->pool_handle != no_frame_handle) {
+            BMP_frame->BMP_header = (char*)memcpy(frame_pool_header(pool, rotated_handle), BMP_frame->BMP_header, BMP_frame->offset);
+            frame_pool_release(pool, BMP_frame->pool_handle);
+        }
+        BMP_frame->pool_handle = rotated_handle;
+    }
+    BMP_frame->load_ms[stage_rotate] = time_ms() - stage_start;
+    return true;
+}
+
+//Loads every frame in the setup file into frames, where frames[i] is the frame on line i*2. A .bmp on more than
+//one line (a ping-pong animation, or a spec going back to an earlier frame) is only decoded the first time, the
+//later lines get a copy that shares its pixels. frame_owner[i] is the frame that frames[i] shares, i when it was
+//decoded and -1 when it wasn't loaded. Returns the number of frames decoded, or -1 if a frame could not be loaded
+int load_frame_table(struct BMP_attributes* frames, int* frame_owner, char** cmd_file_data, int num_frames, enum rotate horizontal_rotate, struct frame_pool* pool) {
+    int frames_decoded = 0;
+    for (int i = 0; i < num_frames; i++)
+        frame_owner[i] = -1;
+    for (int i = 0; i < num_frames; i++) {
+        int owner = 0;
+        while (owner < i && strcmp(cmd_file_data[owner*2], cmd_file_data[i*2]) != 0)
+            owner++;
+        if (owner < i) {
+            memcpy(&frames[i], &frames[owner], sizeof(struct BMP_attributes));
+            memset(frames[i].load_ms, 0, sizeof(frames[i].load_ms)); //it wasn't loaded again
+            frame_owner[i] = owner;
+            continue;
+        }
+        if (!load_BMP_frame(&frames[i], cmd_file_data[i*2], horizontal_rotate, pool))
+            return -1;
+        frame_owner[i] = i;
+        frames_decoded++;
+    }
+    return frames_decoded;
+}
+
+//Gives back the frames load_frame_table decoded
+void free_frame_table(struct BMP_attributes* frames, const int* frame_owner, int num_frames, struct frame_pool* pool) {
+    for (int i = 0; i < num_frames; i++) {
+        if (frame_owner[i] == i)
+            free_BMP_frame(&frames[i], pool);
+    }
+}
+
+//Snaps a loaded frame to shown_BMP (the frame before it, as shown) for --tolerance. A frame that's a view 
+//into its mapped file gets copied into a pool buffer first so it can be changed
+bool snap_BMP_frame(struct BMP_attributes* BMP_frame, struct BMP_attributes* shown_BMP, int tolerance, struct frame_pool* pool, int* pixels_snapped) {
+    if (BMP_frame->pool_handle == no_frame_handle) {
+        if ((BMP_frame->pool_handle = frame_pool_acquire(pool)) == no_frame_handle)
+            return false;
+        BMP_frame->BMP_pixel_array = (int16_t*)memcpy(frame_pool_pixels(pool, BMP_frame->pool_handle), BMP_frame->BMP_pixel_array, frame_pixel_bytes);
+    }
+    *pixels_snapped += snap_frame_pixels(shown_BMP->BMP_pixel_array, BMP_frame->BMP_pixel_array, BMP_frame->BMP_pixel_array, tolerance);
+    return true;
+}
+
+//Builds the palette for the frames listed in the setup file, loading them one at a time. Used by the single 
+//threaded run, which otherwise only ever has a couple of frames loaded
+bool arf_palette_from_files(struct arf_palette* palette, char** cmd_file_data, int num_lines_in_file, enum rotate horizontal_rotate) {
+    struct frame_pool pool;
+    bool loaded = frame_pool_init(&pool, 2);
+    for (int curr_file_num = 0; loaded && curr_file_num < num_lines_in_file; curr_file_num+=2) {
+        struct BMP_attributes frame;
+        memset(&frame, 0, sizeof(frame));
+        if (!load_BMP_frame(&frame, cmd_file_data[curr_file_num], horizontal_rotate, &pool)) {
+            loaded = false;
+            break;
+        }
+        arf_palette_add_frame(palette, &frame);
+        free_BMP_frame(&frame, &pool);
+    }
+    frame_pool_free(&pool);
+    return loaded;
+}
+
+/**************************************************************************************************************
+ *                  Frame Deduplication 
+ **************************************************************************************************************/
+#define manifest_file_name "manifest.txt"
+//The frames and draw direction of one pair. Pairs with the same key always encode to the same .arf
+struct dedup_pair_key {
+    uint64_t last_hash;
+    uint64_t curr_hash;
+    enum draw_direction draw_dir;
+};
+
+//Tracks which .arf each frame pair plays, in play order. A pair either has its own .arf or plays an earlier 
+//pair's .arf, either because the frames were the same or because the encoded bytes came out the same
+//The searches are linear, animations are a few dozen pairs at most
+struct arf_dedup {
+    int num_pairs;
+    char* output_dir;
+    struct dedup_pair_key* pair_keys;
+    struct arf_digest* digests;
+    int* plays; //the earlier pair each pair plays the .arf of (itself when it has its own file)
+    int pairs_reused; //same frames as an earlier pair, so never encoded
+    int deltas_reused; //encoded, but came out the same as an earlier .arf
+};
+
+void arf_dedup_init(struct arf_dedup* dedup, int num_pairs, char* output_dir) {
+    dedup->num_pairs = num_pairs;
+    dedup->output_dir = output_dir;
+    dedup->pair_keys = (struct dedup_pair_key*)calloc(num_pairs, sizeof(struct dedup_pair_key));
+    dedup->digests = (struct arf_digest*)calloc(num_pairs, sizeof(struct arf_digest));
+    dedup->plays = (int*)malloc(num_pairs*sizeof(int));
+    for (int i = 0; i < num_pairs; i++)
+        dedup->plays[i] = i;
+    dedup->pairs_reused = 0;
+    dedup->deltas_reused = 0;
+}
+
+void arf_dedup_free(struct arf_dedup* dedup) {
+    free(dedup->pair_keys);
+    free(dedup->digests);
+    free(dedup->plays);
+}
+
+void hash_BMP_frame(struct BMP_attributes* BMP_frame) {
+    BMP_frame->pixel_hash = fnv1a_64(BMP_frame->BMP_pixel_array, frame_pixel_bytes, fnv1a_64_offset);
+}
+
+//Checks whether an earlier pair went between the same two frames in the same direction
+//Returns true (and points the pair at that pair) if so, then the pair doesn't need encoding
+bool arf_dedup_find_pair(struct arf_dedup* dedup, int pair_num, struct BMP_attributes* last_BMP, struct BMP_attributes* curr_BMP, FILE* log_file) {
+    struct dedup_pair_key* pair_key = &dedup->pair_keys[pair_num];
+    pair_key->last_hash = last_BMP->pixel_hash;
+    pair_key->curr_hash = curr_BMP->pixel_hash;
+    pair_key->draw_dir = curr_BMP->animate_dir;
+    for (int i = 0; i < pair_num; i++) {
+        struct dedup_pair_key* earlier_key = &dedup->pair_keys[i];
+        if (earlier_key->last_hash == pair_key->last_hash && earlier_key->curr_hash == pair_key->curr_hash && earlier_key->draw_dir == pair_key->draw_dir) {
+            dedup->plays[pair_num] = i;
+            dedup->pairs_reused++;
+            fprintf(log_file, "Same frames as pair %d, nothing to encode\n", i+1);
+            return true;
+        }
+    }
+    return false;
+}
+
+//Compares two files byte for byte
+bool files_equal(const char* file_a, const char* file_b) {
+    FILE* fp_a = fopen(file_a, "rb");
+    FILE* fp_b = fopen(file_b, "rb");
+    bool equal = fp_a != NULL && fp_b != NULL;
+    char buff_a[4096], buff_b[4096];
+    while (equal) {
+        size_t read_a = fread(buff_a, 1, sizeof(buff_a), fp_a);
+        size_t read_b = fread(buff_b, 1, sizeof(buff_b), fp_b);
+        if (read_a != read_b || memcmp(buff_a, buff_b, read_a) != 0)
+            equal = false;
+        if (read_a == 0)
+            break;
+    }
+    if (fp_a)
+        fclose(fp_a);
+    if (fp_b)
+        fclose(fp_b);
+    return equal;
+}
+
+//Records the .arf that files2arf just wrote for the pair. If an earlier .arf has the same bytes, the new file is 
+//removed and the pair plays the earlier one instead. Called in pair order so the output doesn't depend on threads
+void arf_dedup_add_arf(struct arf_dedup* dedup, int pair_num, const struct arf_digest* digest, FILE* log_file) {
+    dedup->digests[pair_num] = *digest;
+    for (int i = 0; i < pair_num; i++) {
+        const struct arf_digest* earlier = &dedup->digests[i];
+        //only pairs that have their own file are worth comparing against
+        if (dedup->plays[i] != i || earlier->hash != digest->hash || earlier->length != digest->length)
+            continue;
+        char earlier_file_str[512], output_file_str[512];
+        file_name2output_dir(earlier_file_str, dedup->digests[i].file_name, dedup->output_dir);
+        file_name2output_dir(output_file_str, dedup->digests[pair_num].file_name, dedup->output_dir);
+        if (!files_equal(earlier_file_str, output_file_str))
+            continue;
+        remove(output_file_str);
+        dedup->plays[pair_num] = i;
+        dedup->deltas_reused++;
+        fprintf(log_file, "Same changes as pair %d, reusing: %s\n", i+1, earlier->file_name);
+        return;
+    }
+}
+
+//Writes the manifest of .arf file names in play order (one per line, relative to the output directory) and 
+//prints how much was shared
+bool arf_dedup_write_manifest(struct arf_dedup* dedup) {
+    char manifest_file_str[512];
+    file_name2output_dir(manifest_file_str, (char*)manifest_file_name, dedup->output_dir);
+    FILE* manifest_file = fopen(manifest_file_str, "w");
+    if (manifest_file == NULL) {
+        fprintf(stderr, "ERROR, Failed to create file [%s]\n", manifest_file_str);
+        return false;
+    }
+    int num_files = 0;
+    for (int i = 0; i < dedup->num_pairs; i++) {
+        //a pair can play a pair that plays an earlier pair, follow it back to the one with the file
+        int play_num = i;
+        while (dedup->plays[play_num] != play_num)
+            play_num = dedup->plays[play_num];
+        fprintf(manifest_file, "%s\n", dedup->digests[play_num].file_name);
+        if (play_num == i)
+            num_files++;
+    }
+    fclose(manifest_file);
+    fprintf(stdout, "Dedup: %d pairs in %d .arf files (%d repeated frame pairs, %d repeated changes). Manifest: %s\n", 
+        dedup->num_pairs, num_files, dedup->pairs_reused, dedup->deltas_reused, manifest_file_str);
+    return true;
+}
+/**************************************************************************************************************
+ *                  END Frame Deduplication 
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  Packed Animation
+ **************************************************************************************************************/
+//Every .arf the player opens costs it a directory lookup on the SD card. With --pack the .arf files an animation 
+//plays are put into one animation.pak: "PK", the number of frames (2 bytes), 4 spare bytes, then a table of 
+//[offset (4 bytes), length (4 bytes)] for each frame and the .arf files themselves. Frame N is the .arf of pair N 
+//(the loop pair last), and frames that play the same .arf (from --dedup) share its bytes
+#define pack_file_name "animation.pak"
+#define pack_header_size 8
+#define pack_table_entry_size 8
+#define playlist_file_name "playlist.txt"
+
+//Reads a whole .arf file onto the end of pack_out. Returns false if it isn't there or isn't a .arf
+bool pack_read_arf(struct ARF_writer* pack_out, const char* arf_file_str) {
+    FILE* arf_file = fopen(arf_file_str, "rb");
+    if (arf_file == NULL) {
+        fprintf(stderr, "ERROR, Failed to open file [%s]\n", arf_file_str);
+        return false;
+    }
+    size_t arf_start = pack_out->length;
+    char read_buff[4096];
+    size_t bytes_read;
+    while ((bytes_read = fread(read_buff, 1, sizeof(read_buff), arf_file)) > 0)
+        arf_write(pack_out, read_buff, bytes_read);
+    fclose(arf_file);
+    if (pack_out->length - arf_start < 8 || pack_out->buffer[arf_start] != 'A' || pack_out->buffer[arf_start+1] != 'R') {
+        fprintf(stderr, "ERROR, [%s] isn't a .arf file\n", arf_file_str);
+        return false;
+    }
+    return true;
+}
+
+//The .arf each pair plays, from manifest.txt with --dedup and from the frames' names otherwise
+bool pack_pair_files(char (*pair_files)[512], char** cmd_file_data, int num_pairs, char* output_dir, bool dedup) {
+    if (!dedup) {
+        for (int pair = 0; pair < num_pairs; pair++) {
+            char* last_file_name = extract_file_name(cmd_file_data[pair*2]);
+            char* curr_file_name = extract_file_name(cmd_file_data[((pair+1) % num_pairs)*2]);
+            if (last_file_name == NULL || curr_file_name == NULL)
+                return false;
+            combine_file_names(pair_files[pair], last_file_name, curr_file_name, pair+1);
+        }
+        return true;
+    }
+    char manifest_file_str[512];
+    file_name2output_dir(manifest_file_str, (char*)manifest_file_name, output_dir);
+    FILE* manifest_file = fopen(manifest_file_str, "r");
+    if (manifest_file == NULL) {
+        fprintf(stderr, "ERROR, Failed to open file [%s]\n", manifest_file_str);
+        return false;
+    }
+    int num_read = 0;
+    while (num_read < num_pairs && fgets(pair_files[num_read], 512, manifest_file) != NULL) {
+        pair_files[num_read][strcspn(pair_files[num_read], "\r\n")] = '\0';
+        num_read++;
+    }
+    fclose(manifest_file);
+    if (num_read != num_pairs) {
+        fprintf(stderr, "ERROR, [%s] doesn't have a .arf for every pair\n", manifest_file_str);
+        return false;
+    }
+    return true;
+}
+
+//Packs the animation's .arf files into animation.pak, then removes them (and manifest.txt) from the output folder
+bool pack_animation(char** cmd_file_data, int num_lines_in_file, char* output_dir, const struct compress_options* options) {
+    bool dedup = options->dedup;
+    int num_pairs = (num_lines_in_file+1)/2;
+    if (num_pairs > 0xFFFF) {
+        fprintf(stderr, "ERROR, %s holds at most 65535 frames\n", pack_file_name);
+        return false;
+    }
+    char (*pair_files)[512] = (char (*)[512])malloc(num_pairs*512);
+    if (!pack_pair_files(pair_files, cmd_file_data, num_pairs, output_dir, dedup)) {
+        free(pair_files);
+        return false;
+    }
+    struct ARF_writer pack_out;
+    arf_writer_init(&pack_out);
+    char pack_title[2] = {'P', 'K'};
+    arf_write(&pack_out, pack_title, sizeof(pack_title));
+    uint16_t pack_header[3] = {(uint16_t)num_pairs, 0, 0};
+    arf_write(&pack_out, pack_header, sizeof(pack_header));
+    uint32_t* pack_table = (uint32_t*)calloc(num_pairs*2, sizeof(uint32_t));
+    arf_write(&pack_out, pack_table, num_pairs*pack_table_entry_size);
+    int num_files = 0;
+    bool packed = true;
+    for (int pair = 0; pair < num_pairs && packed; pair++) {
+        int earlier = 0;
+        while (earlier < pair && strcmp(pair_files[earlier], pair_files[pair]) != 0)
+            earlier++;
+        if (earlier < pair) {
+            pack_table[pair*2] = pack_table[earlier*2];
+            pack_table[pair*2+1] = pack_table[earlier*2+1];
+            continue;
+        }
+        char arf_file_str[512];
+        file_name2output_dir(arf_file_str, pair_files[pair], output_dir);
+        //sector laid out .arf files have to start on a sector in the pack as well
+        if (options->sector_align)
+            arf_sector_pad(&pack_out);
+        pack_table[pair*2] = pack_out.length;
+        packed = pack_read_arf(&pack_out, arf_file_str);
+        pack_table[pair*2+1] = pack_out.length - pack_table[pair*2];
+        num_files++;
+    }
+    char pack_file_str[512];
+    char pack_name[] = pack_file_name;
+    file_name2output_dir(pack_file_str, pack_name, output_dir);
+    if (packed) {
+        arf_patch(&pack_out, pack_header_size, pack_table, num_pairs*pack_table_entry_size);
+        packed = arf_writer_flush(&pack_out, pack_file_str);
+        if (!packed)
+            fprintf(stderr, "ERROR, Failed to create file [%s]\n", pack_file_str);
+    }
+    //the loose files are only removed once they're safely in the pack
+    if (packed) {
+        for (int pair = 0; pair < num_pairs; pair++) {
+            char arf_file_str[512];
+            file_name2output_dir(arf_file_str, pair_files[pair], output_dir);
+            remove(arf_file_str);
+        }
+        if (dedup) {
+            char manifest_file_str[512];
+            file_name2output_dir(manifest_file_str, (char*)manifest_file_name, output_dir);
+            remove(manifest_file_str);
+        }
+        fprintf(stdout, "Pack: %d frames from %d .arf files, %s is %zu bytes\n", num_pairs, num_files, pack_file_str, pack_out.length);
+    }
+    free(pack_table);
+    free(pair_files);
+    arf_writer_free(&pack_out);
+    return packed;
+}
+
+//Writes playlist.txt for a ping-pong animation: the .arf each step of the loop plays, forward and then back, in
+//the same format as manifest.txt so the player can go through it the same way. A pack already has them in order
+bool write_playlist(char** cmd_file_data, int num_lines_in_file, char* output_dir, bool dedup) {
+    int num_pairs = (num_lines_in_file+1)/2;
+    char (*pair_files)[512] = (char (*)[512])malloc(num_pairs*512);
+    if (!pack_pair_files(pair_files, cmd_file_data, num_pairs, output_dir, dedup)) {
+        free(pair_files);
+        return false;
+    }
+    char playlist_file_str[512];
+    file_name2output_dir(playlist_file_str, (char*)playlist_file_name, output_dir);
+    FILE* playlist_file = fopen(playlist_file_str, "w");
+    if (playlist_file == NULL) {
+        fprintf(stderr, "ERROR, Failed to create file [%s]\n", playlist_file_str);
+        free(pair_files);
+        return false;
+    }
+    for (int pair = 0; pair < num_pairs; pair++)
+        fprintf(playlist_file, "%s\n", pair_files[pair]);
+    fclose(playlist_file);
+    fprintf(stdout, "Ping-pong: %d frames, %d steps there and back. Playlist: %s\n", num_pairs/2+1, num_pairs, playlist_file_str);
+    free(pair_files);
+    return true;
+}
+/**************************************************************************************************************
+ *                  END Packed Animation
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  Parallel Frame Pair Encoding 
+ **************************************************************************************************************/
+//One (last, curr) pair to turn into an .arf file. The curr frame is a shallow copy so that the 
+//draw direction belongs to the pair, not to the shared frame (the first frame is used again by the loop pair)
+struct arf_job {
+    struct BMP_attributes* last_BMP;
+    struct BMP_attributes curr_BMP;
+    char* output_dir;
+    int file_count;
+    const struct compress_options* options;
+    int num_entries;
+    bool reused; //--dedup found the same pair earlier, so there's nothing to encode
+    struct arf_digest digest;
+    char* log_buf; //everything files2arf printed, flushed to stdout in order once all jobs are done
+    size_t log_len;
+};
+
+struct arf_job_queue {
+    struct arf_job* jobs;
+    int num_jobs;
+    int next_job;
+    pthread_mutex_t job_lock;
+};
+
+//Worker thread. Takes the next job off of the queue until there are none left
+void* arf_job_worker(void* queue_in) {
+    struct arf_job_queue* job_queue = (struct arf_job_queue*)queue_in;
+    //each worker builds its frames in its own buffers
+    struct encode_workspace workspace;
+    encode_workspace_init(&workspace);
+    while (true) {
+        pthread_mutex_lock(&job_queue->job_lock);
+        int job_num = job_queue->next_job++;
+        pthread_mutex_unlock(&job_queue->job_lock);
+        if (job_num >= job_queue->num_jobs)
+            break;
+        struct arf_job* curr_job = &job_queue->jobs[job_num];
+        if (curr_job->reused)
+            continue;
+        FILE* log_file = open_memstream(&curr_job->log_buf, &curr_job->log_len);
+        curr_job->num_entries = files2arf(curr_job->last_BMP, &curr_job->curr_BMP, curr_job->output_dir, curr_job->file_count, curr_job->options, &workspace, log_file, &curr_job->digest);
+        fclose(log_file);
+    }
+    encode_workspace_free(&workspace);
+    return NULL;
+}
+
+//Runs all of the jobs on num_threads worker threads and waits for them to finish
+void run_arf_jobs(struct arf_job* jobs, int num_jobs, int num_threads) {
+    struct arf_job_queue job_queue;
+    job_queue.jobs = jobs;
+    job_queue.num_jobs = num_jobs;
+    job_queue.next_job = 0;
+    pthread_mutex_init(&job_queue.job_lock, NULL);
+    if (num_threads > num_jobs)
+        num_threads = num_jobs;
+    pthread_t* workers = (pthread_t*)malloc(num_threads*sizeof(pthread_t));
+    for (int i = 0; i < num_threads; i++) {
+        pthread_create(&workers[i], NULL, arf_job_worker, &job_queue);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&job_queue.job_lock);
+}
+
+//One setup file's worth of frame pairs. The parallel and batch paths set these up, run every animation's jobs 
+//on the thread pool together, then finish the animations one at a time so each one's output stays in order
+struct animation_jobs {
+    int num_frames;
+    char* output_dir;
+    struct compress_options options; //its own copy, the cache folder belongs to the output folder
+    char cache_dir_str[512];
+    struct arf_job* jobs; //num_frames jobs
+    struct arf_dedup dedup;
+    struct arf_palette palette;
+    int16_t* shown_pixels; //with --tolerance, the frames as they'll be shown (num_frames-1 of them, the first frame is exact)
+    int pixels_snapped;
+};
+
+//Sets up the jobs for one animation, where frames[i] is the frame on line i*2 of the setup file
+//Job i-1 goes from frame i-1 to frame i. The last job loops back around to the first frame
+//The frames have to be hashed already for --dedup and --cache
+void animation_jobs_init(struct animation_jobs* animation, struct arf_job* jobs, struct BMP_attributes** frames, char** cmd_file_data, int num_frames, char* output_dir, const struct compress_options* options) {
+    animation->num_frames = num_frames;
+    animation->output_dir = output_dir;
+    animation->options = *options;
+    animation->jobs = jobs;
+    for (int i = 0; i < num_frames; i++) {
+        jobs[i].last_BMP = frames[i];
+        memcpy(&jobs[i].curr_BMP, frames[(i+1) % num_frames], sizeof(struct BMP_attributes));
+        jobs[i].curr_BMP.animate_dir = draw_dir2num(cmd_file_data[i*2+1]);
+        jobs[i].output_dir = output_dir;
+        jobs[i].file_count = i+1;
+        jobs[i].options = &animation->options;
+    }
+    //with --tolerance each frame is snapped to the one shown before it, which has to happen in order. The shown 
+    //frames belong to the animation (a batch shares the loaded frames). The loop pair goes back to the exact first frame
+    animation->shown_pixels = NULL;
+    animation->pixels_snapped = 0;
+    if (options->tolerance > 0 && num_frames > 1) {
+        animation->shown_pixels = (int16_t*)malloc((size_t)(num_frames-1)*frame_pixel_bytes);
+        for (int i = 0; i < num_frames-1; i++) {
+            int16_t* shown_pixels = animation->shown_pixels + (size_t)i*(s_width*s_height);
+            animation->pixels_snapped += snap_frame_pixels(jobs[i].last_BMP->BMP_pixel_array, jobs[i].curr_BMP.BMP_pixel_array, shown_pixels, options->tolerance);
+            jobs[i].curr_BMP.BMP_pixel_array = shown_pixels;
+            if (options->dedup || options->cache_dir)
+                hash_BMP_frame(&jobs[i].curr_BMP);
+            jobs[i+1].last_BMP = &jobs[i].curr_BMP;
+        }
+    }
+    animation->options.palette = NULL;
+    animation->palette.color_index = NULL;
+    if (options->use_palette && arf_palette_init(&animation->palette)) {
+        for (int i = 0; i < num_frames; i++)
+            arf_palette_add_frame(&animation->palette, frames[i]);
+        if (arf_palette_finish(&animation->palette, output_dir, stdout))
+            animation->options.palette = &animation->palette;
+    }
+    //repeated frame pairs are found up front so no thread encodes them
+    if (options->dedup) {
+        arf_dedup_init(&animation->dedup, num_frames, output_dir);
+        for (int i = 0; i < num_frames; i++) {
+            FILE* log_file = open_memstream(&jobs[i].log_buf, &jobs[i].log_len);
+            jobs[i].reused = arf_dedup_find_pair(&animation->dedup, i, jobs[i].last_BMP, &jobs[i].curr_BMP, log_file);
+            fclose(log_file);
+            if (!jobs[i].reused) {
+                free(jobs[i].log_buf);
+                jobs[i].log_buf = NULL;
+            }
+        }
+    }
+}
+
+//Once the jobs have run, prints everything in the same order the serial path would have. Repeated .arf files 
+//are removed in that order too, so the files kept are the same as the serial path's. Returns the exit code
+int animation_jobs_finish(struct animation_jobs* animation) {
+    int num_frames = animation->num_frames;
+    struct arf_job* jobs = animation->jobs;
+    const struct compress_options* options = &animation->options;
+    int exit_code = 0;
+    for (int i = 0; i <= num_frames; i++) {
+        if (i < num_frames)
+            fprintf(stdout, "curr file num: %d\n", i*2);
+        if (i > 0) {
+            fwrite(jobs[i-1].log_buf, 1, jobs[i-1].log_len, stdout);
+            if (options->dedup && !jobs[i-1].reused && jobs[i-1].num_entries >= 0)
+                arf_dedup_add_arf(&animation->dedup, i-1, &jobs[i-1].digest, stdout);
+        }
+    }
+    int cached_pairs = 0;
+    for (int i = 0; i < num_frames; i++) {
+        if (jobs[i].num_entries < 0)
+            exit_code = 1;
+        if (!jobs[i].reused && jobs[i].digest.from_cache)
+            cached_pairs++;
+        free(jobs[i].log_buf);
+        jobs[i].log_buf = NULL;
+    }
+    if (options->tolerance > 0)
+        fprintf(stdout, "Tolerance: %d changed pixels were within %d of the shown color and left alone\n", animation->pixels_snapped, options->tolerance);
+    if (options->cache_dir)
+        fprintf(stdout, "Cache: %d of %d pairs reused from %s\n", cached_pairs, num_frames, options->cache_dir);
+    if (options->dedup) {
+        if (exit_code == 0 && !arf_dedup_write_manifest(&animation->dedup))
+            exit_code = 1;
+        arf_dedup_free(&animation->dedup);
+    }
+    arf_palette_free(&animation->palette);
+    free(animation->shown_pixels);
+    return exit_code;
+}
+
+//Decodes every frame once into a frame table, then encodes all of the (last, curr) pairs plus the 
+//closing last->first loop pair across num_threads threads. Output matches the serial path byte for byte
+int compress_parallel(char** cmd_file_data, int num_lines_in_file, char* output_dir, const struct compress_options* options) {
+    int num_frames = (num_lines_in_file+1)/2;
+    struct BMP_attributes* frames = (struct BMP_attributes*)calloc(num_frames, sizeof(struct BMP_attributes));
+    int* frame_owner = (int*)malloc(num_frames*sizeof(int));
+    int exit_code = 0;
+    //every frame stays loaded, plus one buffer to rotate a horizontal frame into
+    struct frame_pool pool;
+    if (!frame_pool_init(&pool, num_frames+1)) {
+        frame_pool_free(&pool);
+        free(frames);
+        free(frame_owner);
+        return 1;
+    }
+    if (load_frame_table(frames, frame_owner, cmd_file_data, num_frames, options->horizontal_rotate, &pool) < 0)
+        exit_code = 1;
+    if (exit_code == 0 && num_frames == 1) {
+        fprintf(stdout, "curr file num: %d\n", 0);
+        fprintf(stderr, "There was only one file specified, so no animation was possible.\n");
+        exit_code = 1;
+    }
+    if (exit_code == 0 && (options->dedup || options->cache_dir)) {
+        for (int i = 0; i < num_frames; i++) {
+            if (frame_owner[i] == i)
+                hash_BMP_frame(&frames[i]);
+            else
+                frames[i].pixel_hash = frames[frame_owner[i]].pixel_hash;
+        }
+    }
+    if (exit_code == 0) {
+        struct BMP_attributes** frame_order = (struct BMP_attributes**)malloc(num_frames*sizeof(struct BMP_attributes*));
+        for (int i = 0; i < num_frames; i++)
+            frame_order[i] = &frames[i];
+        struct arf_job* jobs = (struct arf_job*)calloc(num_frames, sizeof(struct arf_job));
+        struct animation_jobs animation;
+        animation_jobs_init(&animation, jobs, frame_order, cmd_file_data, num_frames, output_dir, options);
+        run_arf_jobs(jobs, num_frames, options->num_threads);
+        exit_code = animation_jobs_finish(&animation);
+        free(jobs);
+        free(frame_order);
+    }
+    free_frame_table(frames, frame_owner, num_frames, &pool);
+    free(frames);
+    free(frame_owner);
+    frame_pool_free(&pool);
+    return exit_code;
+}
+
+//The absolute path of a file (full_path has to hold 4096 chars). Falls back to the path as given
+void full_file_path(char* full_path, const char* file_dir) {
+#if slash_chr
+    if (realpath(file_dir, full_path) != NULL)
+        return;
+#else
+    if (_fullpath(full_path, file_dir, 4096) != NULL)
+        return;
+#endif
+    strncpy(full_path, file_dir, 4095);
+    full_path[4095] = '\0';
+}
+
+//Makes the .arf cache folder inside the output folder if it isn't there yet
+bool make_cache_dir(char* cache_dir_str, char* output_dir) {
+    file_name2output_dir(cache_dir_str, (char*)arf_cache_folder, output_dir);
+    struct stat cache_stat;
+    if (stat(cache_dir_str, &cache_stat) != 0 && make_dir(cache_dir_str) != 0) {
+        fprintf(stderr, "ERROR, Failed to create the cache folder [%s]\n", cache_dir_str);
+        return false;
+    }
+    return true;
+}
+
+//Compresses every animation in a batch file (setup file, then output folder, for each one) in one go
+//Each .bmp path is decoded once, no matter how many animations use it, and the pairs from every animation 
+//share the thread pool. Each animation's output is the same as running it on its own
+int compress_batch(char* batch_file_dir, const struct compress_options* options, bool use_cache) {
+    int num_batch_lines;
+    char** batch_file_data = read_batch_file(&num_batch_lines, batch_file_dir);
+    if (batch_file_data == NULL)
+        return 1;
+    if (num_batch_lines % 2 != 0) {
+        fprintf(stderr, "The batch file needs an output folder after every setup file\n");
+        free_files_charpp(batch_file_data, num_batch_lines);
+        return 1;
+    }
+    int num_animations = num_batch_lines/2;
+    int exit_code = 0;
+    struct animation_jobs* animations = (struct animation_jobs*)calloc(num_animations, sizeof(struct animation_jobs));
+    char*** cmd_file_data = (char***)calloc(num_animations, sizeof(char**));
+    int* num_cmd_lines = (int*)calloc(num_animations, sizeof(int));
+    bool* ping_pong = (bool*)calloc(num_animations, sizeof(bool));
+    struct BMP_attributes*** frame_order = (struct BMP_attributes***)calloc(num_animations, sizeof(struct BMP_attributes**));
+    //the frame table holds every unique .bmp path. The lookups are linear, a character has a few hundred frames
+    int max_frames = 0;
+    for (int anim = 0; anim < num_animations && exit_code == 0; anim++) {
+        if (NULL == (cmd_file_data[anim] = read_cmd_file(&num_cmd_lines[anim], batch_file_data[anim*2], &ping_pong[anim]))) {
+            fprintf(stderr, "ERROR, Couldn't read the setup file [%s]\n", batch_file_data[anim*2]);
+            exit_code = 1;
+        }
+        else
+            max_frames += (num_cmd_lines[anim]+1)/2;
+    }
+    struct BMP_attributes* frames = (struct BMP_attributes*)calloc(max_frames, sizeof(struct BMP_attributes));
+    char** frame_paths = (char**)calloc(max_frames, sizeof(char*));
+    char** frame_full_paths = (char**)calloc(max_frames, sizeof(char*)); //the table is keyed by these
+    int num_unique_frames = 0;
+    for (int anim = 0; anim < num_animations && exit_code == 0; anim++) {
+        int num_frames = (num_cmd_lines[anim]+1)/2;
+        if (num_frames == 1) {
+            fprintf(stderr, "[%s] only has one file specified, so no animation was possible.\n", batch_file_data[anim*2]);
+            exit_code = 1;
+            break;
+        }
+        //point each of the animation's frames at their spot in the table
+        frame_order[anim] = (struct BMP_attributes**)malloc(num_frames*sizeof(struct BMP_attributes*));
+        for (int i = 0; i < num_frames; i++) {
+            //the same file can be written different ways in different setup files
+            char full_path[4096];
+            full_file_path(full_path, cmd_file_data[anim][i*2]);
+            int frame_num = 0;
+            while (frame_num < num_unique_frames && strcmp(frame_full_paths[frame_num], full_path) != 0)
+                frame_num++;
+            if (frame_num == num_unique_frames) {
+                frame_paths[num_unique_frames] = cmd_file_data[anim][i*2];
+                frame_full_paths[num_unique_frames++] = strdup(full_path);
+            }
+            frame_order[anim][i] = &frames[frame_num];
+        }
+    }
+    for (int anim = 0; anim < num_animations && exit_code == 0 && use_cache; anim++) {
+        if (!make_cache_dir(animations[anim].cache_dir_str, batch_file_data[anim*2+1]))
+            exit_code = 1;
+    }
+    //every unique frame stays loaded, plus one buffer to rotate a horizontal frame into
+    struct frame_pool pool;
+    memset(&pool, 0, sizeof(struct frame_pool));
+    int frames_loaded = 0;
+    if (exit_code == 0 && !frame_pool_init(&pool, num_unique_frames+1))
+        exit_code = 1;
+    for (frames_loaded = 0; exit_code == 0 && frames_loaded < num_unique_frames; frames_loaded++) {
+        if (!load_BMP_frame(&frames[frames_loaded], frame_paths[frames_loaded], options->horizontal_rotate, &pool)) {
+            exit_code = 1;
+            break;
+        }
+        if (options->dedup || use_cache)
+            hash_BMP_frame(&frames[frames_loaded]);
+    }
+    if (exit_code == 0) {
+        fprintf(stdout, "Batch: %d animations, %d unique frames\n", num_animations, num_unique_frames);
+        int total_jobs = 0;
+        for (int anim = 0; anim < num_animations; anim++)
+            total_jobs += (num_cmd_lines[anim]+1)/2;
+        struct arf_job* jobs = (struct arf_job*)calloc(total_jobs, sizeof(struct arf_job));
+        for (int anim = 0, job_num = 0; anim < num_animations; anim++) {
+            int num_frames = (num_cmd_lines[anim]+1)/2;
+            animation_jobs_init(&animations[anim], &jobs[job_num], frame_order[anim], cmd_file_data[anim], num_frames, batch_file_data[anim*2+1], options);
+            if (use_cache)
+                animations[anim].options.cache_dir = animations[anim].cache_dir_str;
+            job_num += num_frames;
+        }
+        run_arf_jobs(jobs, total_jobs, options->num_threads);
+        for (int anim = 0; anim < num_animations; anim++) {
+            fprintf(stdout, "\nAnimation: %s -> %s\n", batch_file_data[anim*2], batch_file_data[anim*2+1]);
+            if (animation_jobs_finish(&animations[anim]) != 0)
+                exit_code = 1;
+            else if (options->pack && !pack_animation(cmd_file_data[anim], num_cmd_lines[anim], batch_file_data[anim*2+1], options))
+                exit_code = 1;
+            else if (ping_pong[anim] && !options->pack && !write_playlist(cmd_file_data[anim], num_cmd_lines[anim], batch_file_data[anim*2+1], options->dedup))
+                exit_code = 1;
+        }
+        free(jobs);
+    }
+    for (int i = 0; i < frames_loaded; i++) {
+        free_BMP_frame(&frames[i], &pool);
+    }
+    frame_pool_free(&pool);
+    for (int anim = 0; anim < num_animations; anim++) {
+        if (cmd_file_data[anim])
+            free_files_charpp(cmd_file_data[anim], num_cmd_lines[anim]);
+        free(frame_order[anim]);
+    }
+    for (int i = 0; i < num_unique_frames; i++)
+        free(frame_full_paths[i]);
+    free(frames);
+    free(frame_paths);
+    free(frame_full_paths);
+    free(frame_order);
+    free(num_cmd_lines);
+    free(ping_pong);
+    free(cmd_file_data);
+    free(animations);
+    free_files_charpp(batch_file_data, num_batch_lines);
+    return exit_code;
+}
+/**************************************************************************************************************
+ *                  END Parallel Frame Pair Encoding 
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  Sprite Layers
+ **************************************************************************************************************/
+//Encode 5 plays an animation as layers. The first frame is the background, and every frame after it is put 
+//together out of blits: each changed rectangle becomes a "restore the background here" op, a "draw sprite N 
+//at (x, y)" op, or both. A sprite is the part of a rectangle that differs from the background, and it's stored 
+//once in sprites.spr however many frames draw it, so a pupil that keeps going back to the same spots costs 
+//one sprite per spot and then a 6 byte op each time
+#define sprite_file_name "sprites.spr"
+#define sprite_background 0 //sprite 0 is the background, its ops also hold the size of the rect to restore
+
+struct sprite {
+    uint64_t hash;
+    int16_t width;
+    int16_t height;
+    int16_t* pixels;
+};
+
+struct sprite_sheet {
+    const int16_t* background;
+    struct sprite* sprites; //the sprites after the background, sprite N is sprites[N-1]
+    int num_sprites;
+    int capacity;
+    int num_draws;
+    int num_restores;
+};
+
+void sprite_sheet_init(struct sprite_sheet* sheet, const int16_t* background) {
+    memset(sheet, 0, sizeof(struct sprite_sheet));
+    sheet->background = background;
+}
+
+void sprite_sheet_free(struct sprite_sheet* sheet) {
+    for (int i = 0; i < sheet->num_sprites; i++)
+        free(sheet->sprites[i].pixels);
+    free(sheet->sprites);
+    sprite_sheet_init(sheet, NULL);
+}
+
+//Finds the sprite with the same size and pixels as [x0, y0, x1, y1] of the frame, adding it when it's new
+//returns its sprite number
+int sprite_sheet_add(struct sprite_sheet* sheet, const int16_t* frame_pixels, int16_t x0, int16_t y0, int16_t x1, int16_t y1) {
+    int16_t width = x1-x0+1, height = y1-y0+1;
+    int16_t* pixels = (int16_t*)malloc(width*height*sizeof(int16_t));
+    for (int y = 0; y < height; y++)
+        memcpy(pixels + y*width, frame_pixels + (y0+y)*s_width + x0, width*sizeof(int16_t));
+    uint64_t hash = fnv1a_64(pixels, width*height*sizeof(int16_t), fnv1a_64_offset);
+    for (int i = 0; i < sheet->num_sprites; i++) {
+        struct sprite* curr_sprite = &sheet->sprites[i];
+        if (curr_sprite->hash == hash && curr_sprite->width == width && curr_sprite->height == height && 
+            memcmp(curr_sprite->pixels, pixels, width*height*sizeof(int16_t)) == 0) {
+            free(pixels);
+            return i+1;
+        }
+    }
+    if (sheet->num_sprites == sheet->capacity) {
+        sheet->capacity = sheet->capacity ? sheet->capacity*2 : 64;
+        sheet->sprites = (struct sprite*)realloc(sheet->sprites, sheet->capacity*sizeof(struct sprite));
+    }
+    struct sprite* new_sprite = &sheet->sprites[sheet->num_sprites++];
+    new_sprite->hash = hash;
+    new_sprite->width = width;
+    new_sprite->height = height;
+    new_sprite->pixels = pixels;
+    return sheet->num_sprites;
+}
+
+//Writes sprites.spr: "SP", the number of sprites (4 bytes, counting the background), 2 spare bytes, then a table of 
+//[data offset (4 bytes), width, height] per sprite and then each sprite's pixels row by row. The background is sprite 0
+bool sprite_sheet_write(struct sprite_sheet* sheet, char* output_dir, size_t* file_size) {
+    char sprite_file_str[512];
+    char sprite_name[] = sprite_file_name;
+    file_name2output_dir(sprite_file_str, sprite_name, output_dir);
+    struct ARF_writer sprite_out;
+    arf_writer_init(&sprite_out);
+    char sprite_title[2] = {'S', 'P'};
+    arf_write(&sprite_out, sprite_title, sizeof(sprite_title));
+    int num_sprites = sheet->num_sprites+1;
+    arf_write(&sprite_out, &num_sprites, sizeof(int));
+    int16_t spare = 0;
+    arf_write(&sprite_out, &spare, sizeof(int16_t));
+    uint32_t data_offset = 8 + num_sprites*8;
+    for (int i = 0; i < num_sprites; i++) {
+        int16_t size[2] = {s_width, s_height};
+        if (i > 0) {
+            size[0] = sheet->sprites[i-1].width;
+            size[1] = sheet->sprites[i-1].height;
+        }
+        arf_write(&sprite_out, &data_offset, sizeof(uint32_t));
+        arf_write(&sprite_out, size, sizeof(size));
+        data_offset += size[0]*size[1]*sizeof(int16_t);
+    }
+    arf_write(&sprite_out, sheet->background, frame_pixel_bytes);
+    for (int i = 0; i < sheet->num_sprites; i++)
+        arf_write(&sprite_out, sheet->sprites[i].pixels, sheet->sprites[i].width*sheet->sprites[i].height*sizeof(int16_t));
+    bool written = arf_writer_flush(&sprite_out, sprite_file_str);
+    *file_size = sprite_out.length;
+    arf_writer_free(&sprite_out);
+    if (!written)
+        fprintf(stderr, "ERROR, Failed to create file [%s]\n", sprite_file_str);
+    return written;
+}
+
+struct sprite_context {
+    const int16_t* curr_pixels;
+    const struct frame_diff* diff;
+    struct sprite_sheet* sheet;
+    struct ARF_writer* output_arf;
+    int num_ops;
+};
+
+//Writes the ops for one changed rectangle. The sprite is the smallest rect around the pixels that differ from the 
+//background. If a pixel changed outside of it, the whole rectangle gets the background restored first
+//([0, x, y, width, height]) and the sprite ([sprite number, x, y]) is drawn over it
+void sprite_rect_ops(const int16_t rect_bounds[4], void* context) {
+    struct sprite_context* sprite_ctx = (struct sprite_context*)context;
+    const int16_t* curr_pixels = sprite_ctx->curr_pixels;
+    const int16_t* background = sprite_ctx->sheet->background;
+    int16_t sprite_bounds[4] = {rect_bounds[2], rect_bounds[3], rect_bounds[0], rect_bounds[1]};
+    bool has_sprite = false;
+    for (int y = rect_bounds[1]; y <= rect_bounds[3]; y++) {
+        for (int x = rect_bounds[0]; x <= rect_bounds[2]; x++) {
+            if (curr_pixels[y*s_width+x] == background[y*s_width+x])
+                continue;
+            has_sprite = true;
+            if (x < sprite_bounds[0]) sprite_bounds[0] = x;
+            if (y < sprite_bounds[1]) sprite_bounds[1] = y;
+            if (x > sprite_bounds[2]) sprite_bounds[2] = x;
+            if (y > sprite_bounds[3]) sprite_bounds[3] = y;
+        }
+    }
+    bool needs_restore = !has_sprite;
+    for (int y = rect_bounds[1]; y <= rect_bounds[3] && !needs_restore; y++) {
+        for (int x = rect_bounds[0]; x <= rect_bounds[2]; x++) {
+            bool in_sprite = x >= sprite_bounds[0] && x <= sprite_bounds[2] && y >= sprite_bounds[1] && y <= sprite_bounds[3];
+            if (!in_sprite && diff_test(sprite_ctx->diff, y, x)) {
+                needs_restore = true;
+                break;
+            }
+        }
+    }
+    if (needs_restore) {
+        int16_t restore_op[5] = {sprite_background, rect_bounds[0], rect_bounds[1], (int16_t)(rect_bounds[2]-rect_bounds[0]+1), (int16_t)(rect_bounds[3]-rect_bounds[1]+1)};
+        arf_write(sprite_ctx->output_arf, restore_op, sizeof(restore_op));
+        sprite_ctx->sheet->num_restores++;
+        sprite_ctx->num_ops++;
+    }
+    if (has_sprite) {
+        int16_t sprite_num = sprite_sheet_add(sprite_ctx->sheet, curr_pixels, sprite_bounds[0], sprite_bounds[1], sprite_bounds[2], sprite_bounds[3]);
+        int16_t draw_op[3] = {sprite_num, sprite_bounds[0], sprite_bounds[1]};
+        arf_write(sprite_ctx->output_arf, draw_op, sizeof(draw_op));
+        sprite_ctx->sheet->num_draws++;
+        sprite_ctx->num_ops++;
+    }
+}
+
+//Writes the encode 5 ops for going from last_pixels to curr_pixels into output_arf, the rectangles ordered by the 
+//draw direction. Returns the number of ops
+int encode5_frame(const int16_t* last_pixels, const int16_t* curr_pixels, enum draw_direction draw_dir, struct sprite_sheet* sheet, struct frame_diff* diff, struct ARF_writer* output_arf) {
+    diff_frames(last_pixels, curr_pixels, s_height, s_width, diff);
+    struct sprite_context context = {curr_pixels, diff, sheet, output_arf, 0};
+    switch(draw_dir) {
+        case up:
+            grow_dirty_rects<traverse_up>(diff, sprite_rect_ops, &context);
+        break;
+        case down:
+            grow_dirty_rects<traverse_down>(diff, sprite_rect_ops, &context);
+        break;
+        case left:
+            grow_dirty_rects<traverse_left>(diff, sprite_rect_ops, &context);
+        break;
+        case right:
+            grow_dirty_rects<traverse_right>(diff, sprite_rect_ops, &context);
+        break;
+        case invalid:
+            fprintf(stderr, "Invalid direction\n");
         break;
+    }
+    return context.num_ops;
+}
+
+//Runs a whole animation as encode 5: one .arf of ops per frame pair (named like the other encodes) plus the 
+//sprites.spr they draw from. The pairs go in order on one thread since they add to the same sprite sheet
+int compress_sprites(char** cmd_file_data, int num_lines_in_file, char* output_dir, const struct compress_options* options) {
+    int num_frames = (num_lines_in_file+1)/2;
+    if (options->num_threads > 1 || options->dedup || options->cache_dir || options->use_palette)
+        fprintf(stdout, "Encode 5 runs on one thread, without --dedup, --cache or --palette\n");
+    struct BMP_attributes* frames = (struct BMP_attributes*)calloc(num_frames, sizeof(struct BMP_attributes));
+    int* frame_owner = (int*)malloc(num_frames*sizeof(int));
+    int exit_code = 0;
+    struct frame_pool pool;
+    if (!frame_pool_init(&pool, num_frames+1)) {
+        frame_pool_free(&pool);
+        free(frames);
+        free(frame_owner);
+        return 1;
+    }
+    if (load_frame_table(frames, frame_owner, cmd_file_data, num_frames, options->horizontal_rotate, &pool) < 0)
+        exit_code = 1;
+    if (exit_code == 0 && num_frames == 1) {
+        fprintf(stderr, "There was only one file specified, so no animation was possible.\n");
+        exit_code = 1;
+    }
+    if (exit_code == 0) {
+        struct sprite_sheet sheet;
+        sprite_sheet_init(&sheet, frames[0].BMP_pixel_array);
+        struct encode_workspace workspace;
+        encode_workspace_init(&workspace);
+        //with --tolerance the frames are snapped to the one shown before them, the loop goes back to the exact first frame
+        int16_t* shown_pixels[2] = {NULL, NULL};
+        int pixels_snapped = 0;
+        if (options->tolerance > 0) {
+            shown_pixels[0] = (int16_t*)malloc(frame_pixel_bytes);
+            shown_pixels[1] = (int16_t*)malloc(frame_pixel_bytes);
+        }
+        const int16_t* last_pixels = frames[0].BMP_pixel_array;
+        for (int pair = 0; pair < num_frames && exit_code == 0; pair++) {
+            struct BMP_attributes* last_BMP = &frames[pair];
+            struct BMP_attributes* curr_BMP = &frames[(pair+1) % num_frames];
+            const int16_t* curr_pixels = curr_BMP->BMP_pixel_array;
+            if (options->tolerance > 0 && pair < num_frames-1) {
+                pixels_snapped += snap_frame_pixels(last_pixels, curr_pixels, shown_pixels[pair % 2], options->tolerance);
+                curr_pixels = shown_pixels[pair % 2];
+            }
+            enum draw_direction draw_dir = draw_dir2num(cmd_file_data[pair*2+1]);
+            char name_of_output_file[512];
+            char output_file_str[512];
+            combine_file_names(name_of_output_file, last_BMP->file_name, curr_BMP->file_name, pair+1);
+            file_name2output_dir(output_file_str, name_of_output_file, output_dir);
+            fprintf(stdout, "New File Name: %s\n", output_file_str);
+            setup_arf(&workspace.arf_out, draw_dir, 5);
+            int num_ops = encode5_frame(last_pixels, curr_pixels, draw_dir, &sheet, &workspace.diff, &workspace.arf_out);
+            fprintf(stdout, "Encode 5 Count Changes: %d\n", num_ops);
+            load_arf_num_entries(&workspace.arf_out, num_ops);
+            if (!arf_writer_flush(&workspace.arf_out, output_file_str)) {
+                fprintf(stderr, "ERROR, Failed to create file [%s]\n", output_file_str);
+                exit_code = 1;
+            }
+            last_pixels = curr_pixels;
+        }
+        size_t sprite_file_size = 0;
+        if (exit_code == 0 && !sprite_sheet_write(&sheet, output_dir, &sprite_file_size))
+            exit_code = 1;
+        if (options->tolerance > 0)
+            fprintf(stdout, "Tolerance: %d changed pixels were within %d of the shown color and left alone\n", pixels_snapped, options->tolerance);
+        fprintf(stdout, "Sprites: %d sprites drawn %d times, %d background restores, %s is %zu bytes\n", 
+                sheet.num_sprites, sheet.num_draws, sheet.num_restores, sprite_file_name, sprite_file_size);
+        free(shown_pixels[0]);
+        free(shown_pixels[1]);
+        encode_workspace_free(&workspace);
+        sprite_sheet_free(&sheet);
+    }
+    free_frame_table(frames, frame_owner, num_frames, &pool);
+    free(frames);
+    free(frame_owner);
+    frame_pool_free(&pool);
+    return exit_code;
+}
+/**************************************************************************************************************
+ *                  END Sprite Layers
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  Keyframe Container
+ **************************************************************************************************************/
+//The .arf files only make sense played in order from the first .bmp. With --keyframes every frame's delta goes 
+//into one animation.akf, with a full keyframe every keyframe_interval frames and an index of where everything is. 
+//The player can then jump to any frame by drawing the keyframe before it and at most keyframe_interval-1 deltas
+#define container_file_name "animation.akf"
+#define container_header_size 8
+#define container_index_entry_size 8 //[keyframe offset, delta offset], the keyframe offset is 0 when there isn't one
 
+//Encodes last_pixels -> curr_pixels like compress_pair does (palette and sectors included) and adds the .arf to 
+//the end of the container, at arf_offset. Returns the number of entries
+int container_add_arf(struct ARF_writer* container, uint32_t* arf_offset, const int16_t* last_pixels, const int16_t* curr_pixels, enum draw_direction draw_dir, char encode_type, const struct compress_options* options, struct encode_workspace* workspace) {
+    struct ARF_writer* arf_out = &workspace->arf_out;
+    const int16_t* diff_pixels = diff_frame_pair(last_pixels, curr_pixels, draw_dir, options->transpose_columns, workspace);
+    setup_arf(arf_out, draw_dir, encode_type);
+    int num_entries = encode_frame_pair(diff_pixels, draw_dir, encode_type, &options->planner, workspace);
+    load_arf_num_entries(arf_out, num_entries);
+    if (options->palette != NULL) {
+        arf_index_colors(arf_out, options->palette, &workspace->arf_indexed);
+        arf_out = &workspace->arf_indexed;
+    }
+    if (options->sector_align && (encode_type == 1 || encode_type == 2)) {
+        //the sector layout goes into whichever buffer arf_out isn't
+        struct ARF_writer* sector_out = arf_out == &workspace->arf_out ? &workspace->arf_indexed : &workspace->arf_out;
+        arf_sector_align(arf_out, sector_out);
+        arf_out = sector_out;
+        arf_sector_pad(container);
     }
-    load_arf_num_entries(output_file, num_entries);
+    *arf_offset = arf_write(container, arf_out->buffer, arf_out->length);
+    return num_entries;
+}
 
-    fclose(output_file);
+//A keyframe is a whole frame as an encode 4 .arf (solid spans are a run length encoding of the rows). It's 
+//diffed against the frame's inverse so every pixel counts as changed
+int container_add_keyframe(struct ARF_writer* container, uint32_t* arf_offset, const int16_t* frame_pixels, int16_t* inverse_pixels, const struct compress_options* options, struct encode_workspace* workspace) {
+    for (int i = 0; i < s_width*s_height; i++)
+        inverse_pixels[i] = ~frame_pixels[i];
+    return container_add_arf(container, arf_offset, inverse_pixels, frame_pixels, up, 4, options, workspace);
+}
+
+//Writes animation.akf: "AK", the number of frames (2 bytes), the keyframe interval (2 bytes), 2 spare bytes, the index 
+//and then the .arf files. Frame N's delta goes from frame N-1 to frame N, frame 0's is the loop pair from the last frame
+int compress_keyframes(char** cmd_file_data, int num_lines_in_file, char* output_dir, const struct compress_options* options, int keyframe_interval) {
+    int num_frames = (num_lines_in_file+1)/2;
+    //past the number of frames, the first frame is the only keyframe
+    if (keyframe_interval > num_frames)
+        keyframe_interval = num_frames;
+    if (options->num_threads > 1 || options->dedup || options->cache_dir)
+        fprintf(stdout, "--keyframes runs on one thread, without --dedup or --cache\n");
+    struct BMP_attributes* frames = (struct BMP_attributes*)calloc(num_frames, sizeof(struct BMP_attributes));
+    int* frame_owner = (int*)malloc(num_frames*sizeof(int));
+    int exit_code = 0;
+    struct frame_pool pool;
+    if (!frame_pool_init(&pool, num_frames+1)) {
+        frame_pool_free(&pool);
+        free(frames);
+        free(frame_owner);
+        return 1;
+    }
+    if (load_frame_table(frames, frame_owner, cmd_file_data, num_frames, options->horizontal_rotate, &pool) < 0)
+        exit_code = 1;
+    if (exit_code == 0 && num_frames == 1) {
+        fprintf(stderr, "There was only one file specified, so no animation was possible.\n");
+        exit_code = 1;
+    }
+    if (exit_code == 0 && num_frames > 0xFFFF) {
+        fprintf(stderr, "ERROR, %s holds at most 65535 frames\n", container_file_name);
+        exit_code = 1;
+    }
+    if (exit_code == 0) {
+        struct compress_options container_options = *options;
+        struct arf_palette palette;
+        palette.color_index = NULL;
+        container_options.palette = NULL;
+        if (options->use_palette && arf_palette_init(&palette)) {
+            for (int i = 0; i < num_frames; i++)
+                arf_palette_add_frame(&palette, &frames[i]);
+            if (arf_palette_finish(&palette, output_dir, stdout))
+                container_options.palette = &palette;
+        }
+        struct encode_workspace workspace;
+        encode_workspace_init(&workspace);
+        struct ARF_writer container;
+        arf_writer_init(&container);
+        char container_title[2] = {'A', 'K'};
+        arf_write(&container, container_title, sizeof(container_title));
+        uint16_t container_header[3] = {(uint16_t)num_frames, (uint16_t)keyframe_interval, 0};
+        arf_write(&container, container_header, sizeof(container_header));
+        uint32_t* frame_index = (uint32_t*)calloc(num_frames*2, sizeof(uint32_t));
+        arf_write(&container, frame_index, num_frames*container_index_entry_size);
+        //the frames as they're shown (snapped with --tolerance), the last frame's stays around for the loop pair
+        int16_t* shown_pixels[2] = {NULL, NULL};
+        int16_t* inverse_pixels = (int16_t*)malloc(frame_pixel_bytes);
+        int pixels_snapped = 0;
+        int num_keyframes = 0;
+        if (options->tolerance > 0) {
+            shown_pixels[0] = (int16_t*)malloc(frame_pixel_bytes);
+            shown_pixels[1] = (int16_t*)malloc(frame_pixel_bytes);
+        }
+        const int16_t* last_pixels = frames[0].BMP_pixel_array;
+        for (int frame = 0; frame <= num_frames; frame++) {
+            const int16_t* curr_pixels = frames[frame % num_frames].BMP_pixel_array;
+            if (frame > 0 && frame < num_frames && options->tolerance > 0) {
+                pixels_snapped += snap_frame_pixels(last_pixels, curr_pixels, shown_pixels[frame % 2], options->tolerance);
+                curr_pixels = shown_pixels[frame % 2];
+            }
+            if (frame < num_frames && frame % keyframe_interval == 0) {
+                int num_entries = container_add_keyframe(&container, &frame_index[frame*2], curr_pixels, inverse_pixels, &container_options, &workspace);
+                fprintf(stdout, "Keyframe %d: %d lines\n", frame, num_entries);
+                num_keyframes++;
+            }
+            if (frame > 0) {
+                //the loop pair is frame 0's delta
+                enum draw_direction draw_dir = draw_dir2num(cmd_file_data[(frame-1)*2+1]);
+                int num_entries = container_add_arf(&container, &frame_index[(frame % num_frames)*2+1], last_pixels, curr_pixels, draw_dir, options->encode_type, &container_options, &workspace);
+                fprintf(stdout, "Encode %d Count Changes: %d\n", options->encode_type, num_entries);
+            }
+            last_pixels = curr_pixels;
+        }
+        arf_patch(&container, container_header_size, frame_index, num_frames*container_index_entry_size);
+        char container_file_str[512];
+        char container_name[] = container_file_name;
+        file_name2output_dir(container_file_str, container_name, output_dir);
+        fprintf(stdout, "New File Name: %s\n", container_file_str);
+        if (!arf_writer_flush(&container, container_file_str)) {
+            fprintf(stderr, "ERROR, Failed to create file [%s]\n", container_file_str);
+            exit_code = 1;
+        }
+        if (options->tolerance > 0)
+            fprintf(stdout, "Tolerance: %d changed pixels were within %d of the shown color and left alone\n", pixels_snapped, options->tolerance);
+        fprintf(stdout, "Container: %d frames, %d keyframes (every %d frames), %s is %zu bytes\n", 
+                num_frames, num_keyframes, keyframe_interval, container_file_name, container.length);
+        free(frame_index);
+        free(inverse_pixels);
+        free(shown_pixels[0]);
+        free(shown_pixels[1]);
+        arf_writer_free(&container);
+        encode_workspace_free(&workspace);
+        arf_palette_free(&palette);
+    }
+    free_frame_table(frames, frame_owner, num_frames, &pool);
+    free(frames);
+    free(frame_owner);
+    frame_pool_free(&pool);
+    return exit_code;
 }
 /**************************************************************************************************************
- *                 END ARF File Handler
+ *                  END Keyframe Container
+ **************************************************************************************************************/
+
+/**************************************************************************************************************
+ *                  State Graph
  **************************************************************************************************************/
+//An animation played from a list can only go one way. With --graph the setup file is a graph of states (frames) 
+//and the edges allowed between them, and everything goes into one animation.agr: a keyframe for every state and a 
+//delta for every edge. The player can then react to an event by going from the state on the screen to the one it 
+//wants with a single delta, and only falls back to the keyframe when there's no edge for it
+#define graph_file_name "animation.agr"
+#define graph_header_size 8
+#define graph_max_entries 0xFFFF
+//A state graph file (--graph). Every line is either "state <name> <.bmp file>" or "edge <from> <to> <draw direction>", 
+//blank lines and lines starting with # are skipped. The states are numbered in the order they're listed
+struct graph_state {
+    char* name;
+    char* file_dir;
+};
+struct graph_edge {
+    int from;
+    int to;
+    enum draw_direction draw_dir;
+};
+struct animation_graph {
+    struct graph_state* states;
+    int num_states;
+    struct graph_edge* edges;
+    int num_edges;
+};
 
-//Free the BMP pixel array based on how many files have been processed so far.
-void free_BMP_arr(int curr_file_count, BMP_attributes* curr_BMP) {
+void free_animation_graph(struct animation_graph* graph) {
+    for (int i = 0; i < graph->num_states; i++) {
+        free(graph->states[i].name);
+        free(graph->states[i].file_dir);
+    }
+    free(graph->states);
+    free(graph->edges);
+    memset(graph, 0, sizeof(struct animation_graph));
+}
 
-    for (int i = 0; i < 2; i++) {
-        free(curr_BMP[i].BMP_pixel_array);
-        free(curr_BMP[i].BMP_header);
+//Returns the number of the state called name, or -1 if there isn't one
+int find_graph_state(const struct animation_graph* graph, const char* name) {
+    for (int i = 0; i < graph->num_states; i++) {
+        if (strcmp(graph->states[i].name, name) == 0)
+            return i;
     }
+    return -1;
+}
 
+//Splits the next word off the front of *line_pos. Returns NULL when the line is out of words
+char* next_graph_word(char** line_pos) {
+    char* word = *line_pos + strspn(*line_pos, " \t");
+    if (*word == '\0')
+        return NULL;
+    char* word_end = word + strcspn(word, " \t");
+    *line_pos = *word_end == '\0' ? word_end : word_end+1;
+    *word_end = '\0';
+    return word;
 }
 
-//Takes the .bmp header and the new width and height and the pixel array and outputs a .bmp
-void BMP_attr2BMP(BMP_attributes* BMP2Create, char* BMP_file_dir, char* BMP_file_name) {
-    char combined_BMP_file_dir[512];
-    directory_file_combine(combined_BMP_file_dir, BMP_file_dir, BMP_file_name); 
-    FILE* BMP_filep = fopen(combined_BMP_file_dir, "w+");
-    if (BMP_filep == NULL) {
-        fprintf(stderr, "Failed to create the BMP file");
-        return;
+//parses a state graph file. The .bmp file is the rest of the state's line, so it can hold any path. Edges can 
+//only use states listed above them. Returns false (with the line number printed) on anything it doesn't understand
+bool read_graph_file(struct animation_graph* graph, char* graph_file_dir) {
+    memset(graph, 0, sizeof(struct animation_graph));
+    FILE* graph_file;
+    if (NULL == (graph_file = fopen(graph_file_dir, "r"))) {
+        fprintf(stderr, "File Open Failiure\n");
+        return false;
     }
-    //write the last BMP header stored into the new file 
-    fwrite(BMP2Create->BMP_header, 1, BMP2Create->offset, BMP_filep);
-    //Move to where to write the width and height
-    fseek(BMP_filep, 0x12, SEEK_SET); 
-    //replace the size with the updated size. Nothing else should have changed, as the image shouldn't get bigger
-    fwrite(&(BMP2Create->width), sizeof(int), 1, BMP_filep);//write width
-    fwrite(&(BMP2Create->height), sizeof(int), 1, BMP_filep);//write height
+    int max_states = 16;
+    int max_edges = 16;
+    graph->states = (struct graph_state*)malloc(max_states*sizeof(struct graph_state));
+    graph->edges = (struct graph_edge*)malloc(max_edges*sizeof(struct graph_edge));
+    char *line = NULL;
+    size_t len_line = 0;
+    int line_num = 0;
+    bool parsed = true;
+    while (parsed && getline(&line, &len_line, graph_file) != -1) {
+        line_num++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char* line_pos = line;
+        char* keyword = next_graph_word(&line_pos);
+        if (keyword == NULL || keyword[0] == '#')
+            continue;
+        if (strcmp(keyword, "state") == 0) {
+            char* name = next_graph_word(&line_pos);
+            char* file_dir = line_pos + strspn(line_pos, " \t");
+            if (name == NULL || *file_dir == '\0' || find_graph_state(graph, name) >= 0) {
+                parsed = false;
+                break;
+            }
+            if (graph->num_states >= max_states) {
+                max_states *= 2;
+                graph->states = (struct graph_state*)realloc(graph->states, max_states*sizeof(struct graph_state));
+            }
+            graph->states[graph->num_states].name = strdup(name);
+            graph->states[graph->num_states].file_dir = strdup(file_dir);
+            graph->num_states++;
+        }
+        else if (strcmp(keyword, "edge") == 0) {
+            char* from_name = next_graph_word(&line_pos);
+            char* to_name = next_graph_word(&line_pos);
+            char* draw_dir = next_graph_word(&line_pos);
+            struct graph_edge edge;
+            if (from_name == NULL || to_name == NULL || draw_dir == NULL) {
+                parsed = false;
+                break;
+            }
+            edge.from = find_graph_state(graph, from_name);
+            edge.to = find_graph_state(graph, to_name);
+            edge.draw_dir = draw_dir2num(draw_dir);
+            if (edge.from < 0 || edge.to < 0 || edge.from == edge.to || edge.draw_dir == invalid) {
+                parsed = false;
+                break;
+            }
+            for (int i = 0; i < graph->num_edges; i++) {
+                if (graph->edges[i].from == edge.from && graph->edges[i].to == edge.to)
+                    parsed = false;
+            }
+            if (!parsed)
+                break;
+            if (graph->num_edges >= max_edges) {
+                max_edges *= 2;
+                graph->edges = (struct graph_edge*)realloc(graph->edges, max_edges*sizeof(struct graph_edge));
+            }
+            graph->edges[graph->num_edges++] = edge;
+        }
+        else
+            parsed = false;
+    }
+    if (!parsed)
+        fprintf(stderr, "ERROR, Line %d of the graph file isn't a new state or an edge between two different states listed above it\n", line_num);
+    free(line);
+    fclose(graph_file);
+    if (parsed && graph->num_states < 2) {
+        fprintf(stderr, "ERROR, The graph file needs at least two states\n");
+        parsed = false;
+    }
+    if (!parsed)
+        free_animation_graph(graph);
+    return parsed;
+}
 
-    //write out the pixel array
-    fseek(BMP_filep, BMP2Create->offset, SEEK_SET);
-    fwrite(BMP2Create->BMP_pixel_array, sizeof(int16_t), (BMP2Create->size-BMP2Create->offset)/2, BMP_filep);
-    fclose(BMP_filep);
-    
+//A state's entry: its keyframe and the edges leaving it, which are next to each other in the edge table
+struct graph_state_entry {
+    uint32_t keyframe_offset;
+    uint16_t first_edge;
+    uint16_t num_edges;
+};
+//An edge's entry: the state it goes to and its delta
+struct graph_edge_entry {
+    uint16_t to;
+    uint16_t spare;
+    uint32_t delta_offset;
+};
+
+//Writes animation.agr: "AG", the number of states (2 bytes), the number of edges (2 bytes), 2 spare bytes, the state 
+//table, the edge table (grouped by the state the edges leave) and then the .arf files
+int compress_graph(struct animation_graph* graph, char* output_dir, const struct compress_options* options) {
+    int num_states = graph->num_states;
+    int num_edges = graph->num_edges;
+    if (num_states > graph_max_entries || num_edges > graph_max_entries) {
+        fprintf(stderr, "ERROR, %s holds at most %d states and %d edges\n", graph_file_name, graph_max_entries, graph_max_entries);
+        return 1;
+    }
+    if (options->num_threads > 1 || options->dedup || options->cache_dir || options->tolerance > 0)
+        fprintf(stdout, "--graph runs on one thread, without --dedup, --cache or --tolerance\n");
+    struct BMP_attributes* frames = (struct BMP_attributes*)calloc(num_states, sizeof(struct BMP_attributes));
+    int frames_loaded = 0;
+    int exit_code = 0;
+    struct frame_pool pool;
+    if (!frame_pool_init(&pool, num_states+1)) {
+        frame_pool_free(&pool);
+        free(frames);
+        return 1;
+    }
+    for (frames_loaded = 0; frames_loaded < num_states; frames_loaded++) {
+        if (!load_BMP_frame(&frames[frames_loaded], graph->states[frames_loaded].file_dir, options->horizontal_rotate, &pool)) {
+            exit_code = 1;
+            break;
+        }
+    }
+    if (exit_code == 0) {
+        struct compress_options graph_options = *options;
+        struct arf_palette palette;
+        palette.color_index = NULL;
+        graph_options.palette = NULL;
+        if (options->use_palette && arf_palette_init(&palette)) {
+            for (int i = 0; i < num_states; i++)
+                arf_palette_add_frame(&palette, &frames[i]);
+            if (arf_palette_finish(&palette, output_dir, stdout))
+                graph_options.palette = &palette;
+        }
+        struct encode_workspace workspace;
+        encode_workspace_init(&workspace);
+        struct ARF_writer graph_out;
+        arf_writer_init(&graph_out);
+        char graph_title[2] = {'A', 'G'};
+        arf_write(&graph_out, graph_title, sizeof(graph_title));
+        uint16_t graph_header[3] = {(uint16_t)num_states, (uint16_t)num_edges, 0};
+        arf_write(&graph_out, graph_header, sizeof(graph_header));
+        struct graph_state_entry* state_table = (struct graph_state_entry*)calloc(num_states, sizeof(struct graph_state_entry));
+        struct graph_edge_entry* edge_table = (struct graph_edge_entry*)calloc(num_edges > 0 ? num_edges : 1, sizeof(struct graph_edge_entry));
+        size_t state_table_offset = arf_write(&graph_out, state_table, num_states*sizeof(struct graph_state_entry));
+        size_t edge_table_offset = arf_write(&graph_out, edge_table, num_edges*sizeof(struct graph_edge_entry));
+        int16_t* inverse_pixels = (int16_t*)malloc(frame_pixel_bytes);
+        int table_edge = 0;
+        for (int state = 0; state < num_states; state++) {
+            const int16_t* state_pixels = frames[state].BMP_pixel_array;
+            int num_entries = container_add_keyframe(&graph_out, &state_table[state].keyframe_offset, state_pixels, inverse_pixels, &graph_options, &workspace);
+            fprintf(stdout, "State %d (%s): keyframe of %d lines\n", state, graph->states[state].name, num_entries);
+            //the edges leaving the state, in the order they're listed
+            state_table[state].first_edge = (uint16_t)table_edge;
+            for (int edge = 0; edge < num_edges; edge++) {
+                if (graph->edges[edge].from != state)
+                    continue;
+                int to = graph->edges[edge].to;
+                edge_table[table_edge].to = (uint16_t)to;
+                num_entries = container_add_arf(&graph_out, &edge_table[table_edge].delta_offset, state_pixels, frames[to].BMP_pixel_array, 
+                                                graph->edges[edge].draw_dir, options->encode_type, &graph_options, &workspace);
+                fprintf(stdout, "Edge %s -> %s: Encode %d Count Changes: %d\n", graph->states[state].name, graph->states[to].name, options->encode_type, num_entries);
+                table_edge++;
+            }
+            state_table[state].num_edges = (uint16_t)(table_edge - state_table[state].first_edge);
+        }
+        arf_patch(&graph_out, state_table_offset, state_table, num_states*sizeof(struct graph_state_entry));
+        arf_patch(&graph_out, edge_table_offset, edge_table, num_edges*sizeof(struct graph_edge_entry));
+        char graph_file_str[512];
+        char graph_name[] = graph_file_name;
+        file_name2output_dir(graph_file_str, graph_name, output_dir);
+        fprintf(stdout, "New File Name: %s\n", graph_file_str);
+        if (!arf_writer_flush(&graph_out, graph_file_str)) {
+            fprintf(stderr, "ERROR, Failed to create file [%s]\n", graph_file_str);
+            exit_code = 1;
+        }
+        fprintf(stdout, "Graph: %d states, %d edges, %s is %zu bytes\n", num_states, num_edges, graph_file_name, graph_out.length);
+        free(inverse_pixels);
+        free(state_table);
+        free(edge_table);
+        arf_writer_free(&graph_out);
+        encode_workspace_free(&workspace);
+        arf_palette_free(&palette);
+    }
+    for (int i = 0; i < frames_loaded; i++)
+        free_BMP_frame(&frames[i], &pool);
+    free(frames);
+    frame_pool_free(&pool);
+    return exit_code;
+}
+/**************************************************************************************************************
+ *                  END State Graph
+ **************************************************************************************************************/
+
+//Encodes one pair for the single threaded path, going through --dedup and --cache when they're on
+//The pair number is file_count-1. Returns false when the .arf couldn't be written
+bool compress_pair(struct BMP_attributes* last_BMP, struct BMP_attributes* curr_BMP, char* output_dir, int file_count, const struct compress_options* options, struct encode_workspace* workspace, struct arf_dedup* dedup, int* cached_pairs) {
+    if (!options->dedup && !options->cache_dir)
+        return files2arf(last_BMP, curr_BMP, output_dir, file_count, options, workspace, stdout, NULL) >= 0;
+    struct arf_digest digest;
+    if (options->dedup && arf_dedup_find_pair(dedup, file_count-1, last_BMP, curr_BMP, stdout))
+        return true;
+    if (files2arf(last_BMP, curr_BMP, output_dir, file_count, options, workspace, stdout, &digest) < 0)
+        return false;
+    if (digest.from_cache)
+        (*cached_pairs)++;
+    if (options->dedup)
+        arf_dedup_add_arf(dedup, file_count-1, &digest, stdout);
+    return true;
+}
+
+/**************************************************************************************************************
+ *                  Encode Report
+ **************************************************************************************************************/
+bool encode_report_init(struct encode_report* report, char* report_file, char* setup_file, int num_pairs, double parse_ms, double start_ms) {
+    report->report_file = report_file;
+    report->setup_file = setup_file;
+    report->num_pairs = num_pairs;
+    report->pairs = (struct pair_report*)calloc(num_pairs, sizeof(struct pair_report));
+    report->parse_ms = parse_ms;
+    report->start_ms = start_ms;
+    return report->pairs != NULL;
+}
+
+void encode_report_free(struct encode_report* report) {
+    free(report->pairs);
+    report->pairs = NULL;
+}
+
+//Writes str as a JSON string, quotes and all. Windows paths are full of backslashes
+void json_write_string(FILE* json_file, const char* str) {
+    fputc('"', json_file);
+    for (; str != NULL && *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', json_file);
+        if ((unsigned char)*str < 0x20)
+            fprintf(json_file, "\\u%04x", *str);
+        else
+            fputc(*str, json_file);
+    }
+    fputc('"', json_file);
+}
+
+//The spans per changed row, 0 when no row changed
+inline double pair_spans_per_row(const struct pair_report* pair) {
+    return pair->changed_rows > 0 ? (double)pair->num_spans/pair->changed_rows : 0.0;
+}
+
+void encode_report_json(const struct encode_report* report, const struct compress_options* options, FILE* json_file) {
+    const char* dir_names[4] = {"up", "down", "left", "right"};
+    fprintf(json_file, "{\n  \"setup_file\": ");
+    json_write_string(json_file, report->setup_file);
+    fprintf(json_file, ",\n  \"encode_type\": %d,\n  \"threads\": %d,\n  \"parse_ms\": %.3f,\n  \"total_ms\": %.3f,\n  \"pairs\": [", 
+            options->encode_type, options->num_threads, report->parse_ms, time_ms() - report->start_ms);
+    for (int pair_num = 0; pair_num < report->num_pairs; pair_num++) {
+        const struct pair_report* pair = &report->pairs[pair_num];
+        fprintf(json_file, "%s\n    {\"pair\": %d, \"encoded\": %s", pair_num > 0 ? "," : "", pair_num+1, pair->encoded ? "true" : "false");
+        if (!pair->encoded) {
+            fprintf(json_file, "}");
+            continue;
+        }
+        fprintf(json_file, ", \"cached\": %s, \"file\": ", pair->from_cache ? "true" : "false");
+        json_write_string(json_file, pair->file_name);
+        fprintf(json_file, ", \"last\": ");
+        json_write_string(json_file, pair->last_file);
+        fprintf(json_file, ", \"curr\": ");
+        json_write_string(json_file, pair->curr_file);
+        fprintf(json_file, ", \"direction\": \"%s\", \"entries\": %d, \"bytes\": %zu", 
+                pair->draw_dir < 4 ? dir_names[pair->draw_dir] : "invalid", pair->num_entries, pair->num_bytes);
+        if (!pair->from_cache) {
+            fprintf(json_file, ", \"changed_pixels\": %d, \"changed_rows\": %d, \"spans_per_row\": %.3f, \"bounds\": [%d, %d, %d, %d]", 
+                    pair->changed_pixels, pair->changed_rows, pair_spans_per_row(pair), pair->bounds[0], pair->bounds[1], pair->bounds[2], pair->bounds[3]);
+        }
+        fprintf(json_file, ", \"ms\": {");
+        for (int stage = stage_verify; stage < num_stages; stage++)
+            fprintf(json_file, "%s\"%s\": %.3f", stage > stage_verify ? ", " : "", stage_names[stage], pair->stage_ms[stage]);
+        fprintf(json_file, "}}");
+    }
+    fprintf(json_file, "\n  ]\n}\n");
+}
+
+//One row per pair. The spec parse time is the same for every row, so it's only in the JSON
+void encode_report_csv(const struct encode_report* report, FILE* csv_file) {
+    const char* dir_names[4] = {"up", "down", "left", "right"};
+    fprintf(csv_file, "pair,encoded,cached,file,last,curr,direction,entries,bytes,changed_pixels,changed_rows,spans_per_row,x0,y0,x1,y1");
+    for (int stage = stage_verify; stage < num_stages; stage++)
+        fprintf(csv_file, ",%s_ms", stage_names[stage]);
+    fprintf(csv_file, "\n");
+    for (int pair_num = 0; pair_num < report->num_pairs; pair_num++) {
+        const struct pair_report* pair = &report->pairs[pair_num];
+        if (!pair->encoded) {
+            fprintf(csv_file, "%d,0,0,,,,,,,,,,,,,", pair_num+1);
+            for (int stage = stage_verify; stage < num_stages; stage++)
+                fprintf(csv_file, ",");
+            fprintf(csv_file, "\n");
+            continue;
+        }
+        //the file names are quoted, a comma is allowed in them
+        fprintf(csv_file, "%d,1,%d,\"%s\",\"%s\",\"%s\",%s,%d,%zu,", pair_num+1, pair->from_cache ? 1 : 0, pair->file_name, pair->last_file, 
+                pair->curr_file, pair->draw_dir < 4 ? dir_names[pair->draw_dir] : "invalid", pair->num_entries, pair->num_bytes);
+        if (pair->from_cache)
+            fprintf(csv_file, ",,,,,,");
+        else
+            fprintf(csv_file, "%d,%d,%.3f,%d,%d,%d,%d", pair->changed_pixels, pair->changed_rows, pair_spans_per_row(pair), 
+                    pair->bounds[0], pair->bounds[1], pair->bounds[2], pair->bounds[3]);
+        for (int stage = stage_verify; stage < num_stages; stage++)
+            fprintf(csv_file, ",%.3f", pair->stage_ms[stage]);
+        fprintf(csv_file, "\n");
+    }
+}
+
+//Writes the report (CSV when the file ends in .csv, JSON otherwise) and prints how long each stage took in total
+bool encode_report_write(const struct encode_report* report, const struct compress_options* options) {
+    FILE* report_file = fopen(report->report_file, "w");
+    if (report_file == NULL) {
+        fprintf(stderr, "ERROR, Failed to create file [%s]\n", report->report_file);
+        return false;
+    }
+    const char* report_ext = strrchr(report->report_file, '.');
+    if (report_ext != NULL && strcmp(report_ext, ".csv") == 0)
+        encode_report_csv(report, report_file);
+    else
+        encode_report_json(report, options, report_file);
+    fclose(report_file);
+    double stage_totals[num_stages] = {0};
+    stage_totals[stage_parse] = report->parse_ms;
+    for (int pair_num = 0; pair_num < report->num_pairs; pair_num++) {
+        for (int stage = stage_verify; stage < num_stages; stage++)
+            stage_totals[stage] += report->pairs[pair_num].stage_ms[stage];
+    }
+    fprintf(stdout, "Report:");
+    for (int stage = 0; stage < num_stages; stage++)
+        fprintf(stdout, " %s %.1f ms%s", stage_names[stage], stage_totals[stage], stage < num_stages-1 ? "," : "");
+    fprintf(stdout, ". Written to %s\n", report->report_file);
+    return true;
+}
+/**************************************************************************************************************
+ *                  END Encode Report
+ **************************************************************************************************************/
+/**************************************************************************************************************
+ *                  Benchmarks 
+ **************************************************************************************************************/
+//Times the left/right (column) encoders on every frame pair of the setup file, walking the columns with a 
+//stride of s_width against transposing both frames first. Also checks that both give the same .arf bytes
+int bench_transpose(char** cmd_file_data, int num_lines_in_file, int iterations, enum rotate horizontal_rotate) {
+    int num_frames = (num_lines_in_file+1)/2;
+    if (num_frames < 2) {
+        fprintf(stderr, "Need at least two frames to benchmark\n");
+        return 1;
+    }
+    struct BMP_attributes* frames = (struct BMP_attributes*)calloc(num_frames, sizeof(struct BMP_attributes));
+    int frames_loaded = 0;
+    struct frame_pool pool;
+    if (frame_pool_init(&pool, num_frames+1)) {
+        for (frames_loaded = 0; frames_loaded < num_frames; frames_loaded++) {
+            if (!load_BMP_frame(&frames[frames_loaded], cmd_file_data[frames_loaded*2], horizontal_rotate, &pool))
+                break;
+        }
+    }
+    int exit_code = 0;
+    if (frames_loaded == num_frames) {
+        struct encode_workspace workspace;
+        encode_workspace_init(&workspace);
+        struct ARF_writer strided_arf;
+        arf_writer_init(&strided_arf);
+        const enum draw_direction column_dirs[2] = {left, right};
+        fprintf(stdout, "%-8s %-6s %-6s %14s %14s %8s\n", "pair", "encode", "dir", "strided(ms)", "transposed(ms)", "speedup");
+        for (int pair = 0; pair < num_frames; pair++) {
+            const int16_t* last_pixels = frames[pair].BMP_pixel_array;
+            const int16_t* curr_pixels = frames[(pair+1) % num_frames].BMP_pixel_array;
+            for (char encode_type = 1; encode_type <= 2; encode_type++) {
+                for (int dir = 0; dir < 2; dir++) {
+                    double mode_ms[2];
+                    for (int transposed = 0; transposed < 2; transposed++) {
+                        double start = time_ms();
+                        for (int i = 0; i < iterations; i++) {
+                            const int16_t* diffed_pixels = diff_frame_pair(last_pixels, curr_pixels, column_dirs[dir], transposed, &workspace);
+                            setup_arf(&workspace.arf_out, column_dirs[dir], encode_type);
+                            load_arf_num_entries(&workspace.arf_out, encode_frame_pair(diffed_pixels, column_dirs[dir], encode_type, NULL, &workspace));
+                        }
+                        mode_ms[transposed] = (time_ms()-start)/iterations;
+                        //keep the strided output to compare against
+                        if (!transposed) {
+                            arf_writer_reset(&strided_arf);
+                            arf_write(&strided_arf, workspace.arf_out.buffer, workspace.arf_out.length);
+                        }
+                    }
+                    if (strided_arf.length != workspace.arf_out.length || memcmp(strided_arf.buffer, workspace.arf_out.buffer, strided_arf.length) != 0) {
+                        fprintf(stderr, "Pair %d encode %d: strided and transposed output differ\n", pair, encode_type);
+                        exit_code = 1;
+                    }
+                    fprintf(stdout, "%-8d %-6d %-6s %14.3f %14.3f %7.2fx\n", pair, encode_type, dir == 0 ? "left" : "right", mode_ms[0], mode_ms[1], mode_ms[0]/mode_ms[1]);
+                }
+            }
+        }
+        arf_writer_free(&strided_arf);
+        encode_workspace_free(&workspace);
+    }
+    else {
+        exit_code = 1;
+    }
+    for (int i = 0; i < frames_loaded; i++) {
+        free_BMP_frame(&frames[i], &pool);
+    }
+    free(frames);
+    frame_pool_free(&pool);
+    return exit_code;
 }
+/**************************************************************************************************************
+ *                  END Benchmarks 
+ **************************************************************************************************************/
 
+//The encode type argument. Anything that isn't a known type is encode 1
+char parse_encode_type(char* encode_type_str) {
+    if (strcmp(encode_type_str, "2") == 0)
+        return 2;
+    if (strcmp(encode_type_str, "3") == 0)
+        return 3;
+    if (strcmp(encode_type_str, "4") == 0)
+        return 4;
+    if (strcmp(encode_type_str, "5") == 0)
+        return 5;
+    if (strcmp(encode_type_str, "6") == 0)
+        return 6;
+    return 1;
+}
 
+//Once the encode type is known: sets up the span planner for it and turns off the options it doesn't work with. 
+//--sector-align only has a layout for encodes 1 and 2 (the ops of the others can be bigger than a sector) and 
+//encode 6 is the display's own colors
+void finish_encode_options(struct compress_options* options, enum span_plan plan, const struct bus_cost_model* bus) {
+    span_planner_init(&options->planner, plan, bus, options->encode_type == 6);
+    if (options->sector_align && options->encode_type != 1 && options->encode_type != 2) {
+        fprintf(stdout, "--sector-align only lays out encodes 1 and 2, so it's ignored\n");
+        options->sector_align = false;
+    }
+    if (options->use_palette && options->encode_type == 6) {
+        fprintf(stdout, "Encode 6 writes the colors straight to the display, --palette is ignored\n");
+        options->use_palette = false;
+    }
+}
 
 //The main function runs through and analyzes the information 
 int main(int argc, char *argv[])
 {   
-    char encode_type;
+    struct compress_options options;
     char input_dir_file_str[512];
-
-    if (argc < 3)
-        printf("Usage: (animate_compress.exe in_setup_file.txt out_directory)\n");
-    else {
-        if (argc >= 4) {
-            if (strcmp(argv[3], "1") == 0)
-                encode_type = 1;
-            else if (strcmp(argv[3], "2") == 0)
-                encode_type = 2;
+    int bench_iterations = 0;
+    options.encode_type = 1;
+    options.num_threads = 1;
+    options.transpose_columns = false;
+    //the player shows a horizontal bmp with its rows as columns, so that's the default
+    options.horizontal_rotate = transpose;
+    options.dedup = false;
+    options.cache_dir = NULL;
+    const struct bus_cost_model* bus = &bus_models[default_bus_model];
+    enum span_plan plan = plan_optimal;
+    options.use_palette = false;
+    options.tolerance = 0;
+    options.palette = NULL;
+    options.sector_align = false;
+    options.pack = false;
+    options.report = NULL;
+    char* report_file = NULL;
+    double start_ms = time_ms();
+    int keyframe_interval = 0;
+    bool state_graph = false;
+    bool use_cache = false;
+    char cache_dir_str[512];
+    char* batch_file_dir = NULL;
+    //the positional arguments (setup file, output directory, encode type), with the options pulled out
+    char* pos_argv[4] = {argv[0], NULL, NULL, NULL};
+    int pos_argc = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i+1 < argc) {
+            options.num_threads = atoi(argv[++i]);
+            //-j 0 uses every core on the machine
+            if (options.num_threads <= 0)
+                options.num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        else if (strcmp(argv[i], "--transpose") == 0) {
+            options.transpose_columns = true;
+        }
+        else if (strcmp(argv[i], "--rotate-horizontal") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "cw") == 0)
+                options.horizontal_rotate = CW;
+            else if (strcmp(argv[i], "ccw") == 0)
+                options.horizontal_rotate = CCW;
             else
-                encode_type = 1;
+                options.horizontal_rotate = transpose;
         }
-        else {
-            encode_type = 1;
+        else if (strcmp(argv[i], "--dedup") == 0) {
+            options.dedup = true;
+        }
+        else if (strcmp(argv[i], "--cache") == 0) {
+            use_cache = true;
+        }
+        else if (strcmp(argv[i], "--bus") == 0 && i+1 < argc) {
+            i++;
+            if (NULL == (bus = find_bus_model(argv[i]))) {
+                fprintf(stderr, "Unknown bus %s, the buses are:", argv[i]);
+                for (int model = 0; model < num_bus_models; model++)
+                    fprintf(stderr, " %s", bus_models[model].name);
+                fprintf(stderr, "\n");
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--plan") == 0 && i+1 < argc) {
+            i++;
+            plan = strcmp(argv[i], "greedy") == 0 ? plan_greedy : plan_optimal;
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0 && i+1 < argc) {
+            options.tolerance = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--keyframes") == 0 && i+1 < argc) {
+            keyframe_interval = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--graph") == 0) {
+            state_graph = true;
+        }
+        else if (strcmp(argv[i], "--sector-align") == 0) {
+            options.sector_align = true;
+        }
+        else if (strcmp(argv[i], "--report") == 0 && i+1 < argc) {
+            report_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--pack") == 0) {
+            options.pack = true;
+        }
+        else if (strcmp(argv[i], "--palette") == 0) {
+            options.use_palette = true;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i+1 < argc) {
+            batch_file_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bench-transpose") == 0 && i+1 < argc) {
+            bench_iterations = atoi(argv[++i]);
+        }
+        else if (pos_argc < 4) {
+            pos_argv[pos_argc++] = argv[i];
+        }
+    }
+
+    if (bench_iterations > 0 && pos_argc >= 2) {
+        int num_lines_in_file;
+        char** cmd_file_data; 
+        if (NULL == (cmd_file_data = read_cmd_file(&num_lines_in_file, pos_argv[input_dir_argv], NULL)))
+            return 1;
+        int exit_code = bench_transpose(cmd_file_data, num_lines_in_file, bench_iterations, options.horizontal_rotate);
+        free_files_charpp(cmd_file_data, num_lines_in_file);
+        return exit_code;
+    }
+    if (batch_file_dir != NULL) {
+        //in batch mode the only positional argument is the encode type
+        if (pos_argc >= 2)
+            options.encode_type = parse_encode_type(pos_argv[1]);
+        fprintf(stdout, "Encode Type: %d\n\n", options.encode_type);
+        finish_encode_options(&options, plan, bus);
+        if (options.encode_type == 5) {
+            fprintf(stderr, "Encode 5 has a sprite sheet per animation, run each setup file on its own\n");
+            return 1;
+        }
+        if (keyframe_interval > 0 || state_graph) {
+            fprintf(stderr, "--keyframes and --graph make one container per animation, run each setup file on its own\n");
+            return 1;
+        }
+        if (report_file != NULL)
+            fprintf(stdout, "--report covers one animation, it's ignored with --batch\n");
+        return compress_batch(batch_file_dir, &options, use_cache);
+    }
+    if (pos_argc < 3)
+        printf("Usage: (animate_compress.exe in_setup_file.txt out_directory [encode_type] [-j num_threads] [--transpose] [--rotate-horizontal transpose|cw|ccw] [--dedup] [--cache] [--bus mega16|shield8|sam3x] [--plan optimal|greedy] [--palette] [--tolerance channel_delta] [--keyframes interval] [--graph] [--pack] [--sector-align] [--report report.json|report.csv])\n"
+               "       (animate_compress.exe --batch batch_file.txt [encode_type] [options])\n"
+               "       (animate_compress.exe in_setup_file.txt --bench-transpose iterations)\n");
+    else {
+        if (pos_argc >= 4)
+            options.encode_type = parse_encode_type(pos_argv[3]);
+        fprintf(stdout, "Encode Type: %d\n\n", options.encode_type);
+        finish_encode_options(&options, plan, bus);
+        if (use_cache) {
+            //the cache lives in its own folder in the output folder
+            if (!make_cache_dir(cache_dir_str, pos_argv[output_dir_argv]))
+                return 1;
+            options.cache_dir = cache_dir_str;
         }
-        fprintf(stdout, "Encode Type: %d\n\n", encode_type);
         //Store the input file's directory
-        strcpy(input_dir_file_str, argv[input_dir_argv]);
+        strcpy(input_dir_file_str, pos_argv[input_dir_argv]);
+        //with --graph the input file is a state graph instead of a list of frames
+        if (state_graph) {
+            if (options.encode_type == 5) {
+                fprintf(stderr, "Encode 5 draws from one background, it can't be used with --graph\n");
+                return 1;
+            }
+            if (keyframe_interval > 0 || options.pack)
+                fprintf(stdout, "%s is already one file with a keyframe per state, --keyframes and --pack are ignored\n", graph_file_name);
+            if (report_file != NULL)
+                fprintf(stdout, "--report covers the .arf files of frame pairs, it's ignored with --graph\n");
+            struct animation_graph graph;
+            if (!read_graph_file(&graph, input_dir_file_str))
+                return 1;
+            int exit_code = compress_graph(&graph, pos_argv[output_dir_argv], &options);
+            free_animation_graph(&graph);
+            return exit_code;
+        }
         int num_lines_in_file;
         char** cmd_file_data; 
+        bool ping_pong;
+        double parse_start = time_ms();
         //Read in the cmd file
-        if (NULL == (cmd_file_data = read_cmd_file(&num_lines_in_file, input_dir_file_str))) {
+        if (NULL == (cmd_file_data = read_cmd_file(&num_lines_in_file, input_dir_file_str, &ping_pong))) {
             //failed to parse the file.
             return 1;
         }
-        //Now time to analyze the cmd file data
-        int file_count = 0;
-        struct BMP_attributes BMP_handler[total_BMP_attr]; 
-        //struct BMP_attributes* BMP_attr_point; 
-        //serach through all of the data in the setup file 
-        char* temp_extract;
-        for (int curr_file_num = 0; curr_file_num < num_lines_in_file; curr_file_num+=2) {
-            //verify the name is a .bmp extension 
-            if ((temp_extract = extract_file_name(cmd_file_data[curr_file_num])) == NULL) {
+        //--report follows the frame pairs, which the sprite sheet and the containers don't have
+        struct encode_report report;
+        report.pairs = NULL;
+        if (report_file != NULL && (options.encode_type == 5 || keyframe_interval > 0))
+            fprintf(stdout, "--report covers the .arf files of frame pairs, it's ignored with encode 5 and --keyframes\n");
+        else if (report_file != NULL) {
+            if (!encode_report_init(&report, report_file, input_dir_file_str, (num_lines_in_file+1)/2, time_ms() - parse_start, start_ms)) {
                 free_files_charpp(cmd_file_data, num_lines_in_file);
-                free_BMP_arr(file_count, BMP_handler);
                 return 1;
             }
-            if (!verify_bmp_file_name(temp_extract)) {
-                fprintf(stderr, "ERROR, File Extension isn't exactly (.bmp). Case sensitive\n");
+            options.report = &report;
+        }
+        //encode 5 is a layered format with its own sprite sheet, so it has its own path
+        if (options.encode_type == 5) {
+            if (keyframe_interval > 0)
+                fprintf(stdout, "Encode 5 draws from its background, --keyframes is ignored\n");
+            int exit_code = compress_sprites(cmd_file_data, num_lines_in_file, pos_argv[output_dir_argv], &options);
+            if (exit_code == 0 && options.pack && !pack_animation(cmd_file_data, num_lines_in_file, pos_argv[output_dir_argv], &options))
+                exit_code = 1;
+            if (exit_code == 0 && ping_pong && !options.pack && !write_playlist(cmd_file_data, num_lines_in_file, pos_argv[output_dir_argv], false))
+                exit_code = 1;
+            free_files_charpp(cmd_file_data, num_lines_in_file);
+            return exit_code;
+        }
+        if (keyframe_interval > 0) {
+            if (options.pack)
+                fprintf(stdout, "%s is already one file, --pack is ignored\n", container_file_name);
+            int exit_code = compress_keyframes(cmd_file_data, num_lines_in_file, pos_argv[output_dir_argv], &options, keyframe_interval);
+            free_files_charpp(cmd_file_data, num_lines_in_file);
+            return exit_code;
+        }
+        //a ping-pong animation lists every frame but the ends twice, the frame table only decodes each one once
+        if (options.num_threads > 1 || ping_pong) {
+            int exit_code = compress_parallel(cmd_file_data, num_lines_in_file, pos_argv[output_dir_argv], &options);
+            if (exit_code == 0 && options.pack && !pack_animation(cmd_file_data, num_lines_in_file, pos_argv[output_dir_argv], &options))
+                exit_code = 1;
+            if (exit_code == 0 && ping_pong && !options.pack && !write_playlist(cmd_file_data, num_lines_in_file, pos_argv[output_dir_argv], options.dedup))
+                exit_code = 1;
+            if (options.report) {
+                if (exit_code == 0 && !encode_report_write(&report, &options))
+                    exit_code = 1;
+                encode_report_free(&report);
+            }
+            free_files_charpp(cmd_file_data, num_lines_in_file);
+            return exit_code;
+        }
+        //the palette needs every frame's colors before anything is encoded
+        struct arf_palette palette;
+        palette.color_index = NULL;
+        if (options.use_palette && arf_palette_init(&palette)) {
+            if (!arf_palette_from_files(&palette, cmd_file_data, num_lines_in_file, options.horizontal_rotate)) {
                 free_files_charpp(cmd_file_data, num_lines_in_file);
-                free_BMP_arr(file_count, BMP_handler);
+                encode_report_free(&report);
+                arf_palette_free(&palette);
                 return 1;
             }
+            if (arf_palette_finish(&palette, pos_argv[output_dir_argv], stdout))
+                options.palette = &palette;
+        }
+        //Now time to analyze the cmd file data
+        int file_count = 0;
+        struct encode_workspace workspace;
+        encode_workspace_init(&workspace);
+        //the first, last and current frames, plus one buffer to rotate a horizontal frame into
+        struct frame_pool pool;
+        if (!frame_pool_init(&pool, total_BMP_attr+1)) {
+            free_files_charpp(cmd_file_data, num_lines_in_file);
+            encode_report_free(&report);
+            encode_workspace_free(&workspace);
+            frame_pool_free(&pool);
+            arf_palette_free(&palette);
+            return 1;
+        }
+        struct BMP_attributes BMP_handler[total_BMP_attr]; 
+        memset(BMP_handler, 0, sizeof(BMP_handler));
+        //The frames are handed off by pointer. The last frame starts out as the first frame, after that the 
+        //current and last frames trade slots
+        struct BMP_attributes* first_BMP = &BMP_handler[first_BMP_attr];
+        struct BMP_attributes* last_BMP = first_BMP;
+        struct BMP_attributes* curr_BMP = &BMP_handler[curr_BMP_attr];
+        struct BMP_attributes* spare_BMP = &BMP_handler[last_BMP_attr];
+        struct arf_dedup dedup;
+        int cached_pairs = 0;
+        bool pairs_encoded = true;
+        int pixels_snapped = 0;
+        if (options.dedup)
+            arf_dedup_init(&dedup, (num_lines_in_file+1)/2, pos_argv[output_dir_argv]);
+        //serach through all of the data in the setup file 
+        for (int curr_file_num = 0; curr_file_num < num_lines_in_file; curr_file_num+=2) {
             fprintf(stdout, "curr file num: %d\n", curr_file_num);
 
             //this switch sets up BMP files and analyzes them
@@ -1029,70 +4403,62 @@ int main(int argc, char *argv[])
                 //the first BMP file. Set up the first BMP file and the last file*
                 //also fills up the pixel array
                 /////////////////////////////////////////////
-                    BMP_handler[first_BMP_attr].file_name = extract_file_name(cmd_file_data[curr_file_num]);
-                    BMP_handler[first_BMP_attr].BMP_file = fopen(cmd_file_data[curr_file_num], "rb");
-                    if (BMP_handler[first_BMP_attr].BMP_file == NULL) {
-                        fprintf(stderr, "ERROR, Failed to open file [%s]\n", cmd_file_data[curr_file_num]);
-                        free_files_charpp(cmd_file_data, num_lines_in_file);
-                        free_BMP_arr(file_count, BMP_handler);
-                        return 1;
-                    }
-                    //if the file isn't a valid bmp, free
-                    if(!verify_bmp(&BMP_handler[first_BMP_attr])) {
-                        fprintf(stderr, "Exiting Due to Failed BMP...\n");
+                    if (!load_BMP_frame(first_BMP, cmd_file_data[curr_file_num], options.horizontal_rotate, &pool)) {
                         free_files_charpp(cmd_file_data, num_lines_in_file);
-                        free_BMP_arr(file_count, BMP_handler);
+                        encode_report_free(&report);
+                        free_BMP_arr(first_BMP, last_BMP, &pool);
+                        encode_workspace_free(&workspace);
+                        frame_pool_free(&pool);
+                        arf_palette_free(&palette);
+                        if (options.dedup)
+                            arf_dedup_free(&dedup);
                         return 1;
                     }
-                    //Fills the values of the BMP pixel array
-                    BMP_handler[first_BMP_attr].BMP_pixel_array = (int16_t*)malloc((BMP_handler[first_BMP_attr].size-BMP_handler[first_BMP_attr].offset)); 
-                    fseek(BMP_handler[first_BMP_attr].BMP_file, BMP_handler[first_BMP_attr].offset, SEEK_SET);
-                    fread(BMP_handler[first_BMP_attr].BMP_pixel_array, sizeof(int16_t), (BMP_handler[first_BMP_attr].size-BMP_handler[first_BMP_attr].offset)/2, BMP_handler[first_BMP_attr].BMP_file);
-                    //Free up the BMP file
-                    fclose(BMP_handler[first_BMP_attr].BMP_file);
                     //Can't fill the direction to draw in until the last file has been hit
-
-                    //First file and last file are the same data, so copy/paste
-                    memcpy(&BMP_handler[last_BMP_attr], &BMP_handler[first_BMP_attr], sizeof(struct BMP_attributes));
-                    BMP_handler[last_BMP_attr].BMP_pixel_array = (int16_t*)malloc(BMP_handler[last_BMP_attr].size-BMP_handler[last_BMP_attr].offset);
-                    memcpy(BMP_handler[last_BMP_attr].BMP_pixel_array, BMP_handler[first_BMP_attr].BMP_pixel_array, (BMP_handler[last_BMP_attr].size-BMP_handler[last_BMP_attr].offset));
-                    BMP_handler[last_BMP_attr].BMP_header = (char*)malloc(BMP_handler[last_BMP_attr].offset);
-                    memcpy(BMP_handler[last_BMP_attr].BMP_header, BMP_handler[first_BMP_attr].BMP_header, BMP_handler[last_BMP_attr].offset);
+                    if (options.dedup || options.cache_dir)
+                        hash_BMP_frame(first_BMP);
                 break;
                 default: //sets up the current File*
                 /////////////////////////////////////////////
-                    BMP_handler[curr_BMP_attr].file_name = extract_file_name(cmd_file_data[curr_file_num]);
-                    BMP_handler[curr_BMP_attr].BMP_file = fopen(cmd_file_data[curr_file_num], "rb");
-                    if (BMP_handler[curr_BMP_attr].BMP_file == NULL) {
-                        fprintf(stderr, "ERROR, Failed to open file [%s]\n", cmd_file_data[curr_file_num]);
+                    if (!load_BMP_frame(curr_BMP, cmd_file_data[curr_file_num], options.horizontal_rotate, &pool)) {
                         free_files_charpp(cmd_file_data, num_lines_in_file);
-                        free_BMP_arr(file_count, BMP_handler);
+                        encode_report_free(&report);
+                        free_BMP_arr(first_BMP, last_BMP, &pool);
+                        encode_workspace_free(&workspace);
+                        frame_pool_free(&pool);
+                        arf_palette_free(&palette);
+                        if (options.dedup)
+                            arf_dedup_free(&dedup);
                         return 1;
                     }
-                    //if the file isn't a valid bmp, free
-                    if(!verify_bmp(&BMP_handler[curr_BMP_attr])) {
-                        fprintf(stderr, "Exiting Due to Failed BMP...\n");
+                    //Fill in the draw direction
+                    curr_BMP->animate_dir = draw_dir2num(cmd_file_data[curr_file_num-1]);
+                    if (options.tolerance > 0 && !snap_BMP_frame(curr_BMP, last_BMP, options.tolerance, &pool, &pixels_snapped)) {
                         free_files_charpp(cmd_file_data, num_lines_in_file);
-                        free_BMP_arr(file_count, BMP_handler);
+                        encode_report_free(&report);
+                        free_BMP_arr(first_BMP, last_BMP, &pool);
+                        free_BMP_frame(curr_BMP, &pool);
+                        encode_workspace_free(&workspace);
+                        frame_pool_free(&pool);
+                        arf_palette_free(&palette);
+                        if (options.dedup)
+                            arf_dedup_free(&dedup);
                         return 1;
                     }
-                    //Fills the values of the BMP pixel array
-                    BMP_handler[curr_BMP_attr].BMP_pixel_array = (int16_t*)malloc((BMP_handler[curr_BMP_attr].size-BMP_handler[curr_BMP_attr].offset)); 
-                    fseek(BMP_handler[curr_BMP_attr].BMP_file, BMP_handler[curr_BMP_attr].offset, SEEK_SET);
-                    fread(BMP_handler[curr_BMP_attr].BMP_pixel_array, sizeof(int16_t), (BMP_handler[curr_BMP_attr].size-BMP_handler[curr_BMP_attr].offset)/2, BMP_handler[curr_BMP_attr].BMP_file);
-                    //Fill in the draw direction
-                    BMP_handler[curr_BMP_attr].animate_dir = draw_dir2num(cmd_file_data[curr_file_num-1]);
-                    //Free up the BMP file
-                    fclose(BMP_handler[curr_BMP_attr].BMP_file);
                     //Now that the files have been properly loaded in, now they can be analyzed
-                    files2arf(&BMP_handler[last_BMP_attr], &BMP_handler[curr_BMP_attr], argv[output_dir_argv], file_count, encode_type);
-                    //allow for reallocation of data
-                    free(BMP_handler[last_BMP_attr].BMP_pixel_array);
-                    free(BMP_handler[last_BMP_attr].BMP_header);
-                    BMP_handler[last_BMP_attr].BMP_pixel_array = NULL;
-                    BMP_handler[last_BMP_attr].BMP_header = NULL;
-                    //Now move the data from the current file to the last file 
-                    memcpy(&BMP_handler[last_BMP_attr], &BMP_handler[curr_BMP_attr], sizeof(struct BMP_attributes));
+                    if (options.dedup || options.cache_dir)
+                        hash_BMP_frame(curr_BMP);
+                    //a pair that fails is reported and the rest still get encoded, like the -j path does
+                    if (!compress_pair(last_BMP, curr_BMP, pos_argv[output_dir_argv], file_count, &options, &workspace, &dedup, &cached_pairs))
+                        pairs_encoded = false;
+                    //give the last frame's buffers back (unless the last file is still the first file) and reuse its slot
+                    if (last_BMP != first_BMP) {
+                        free_BMP_frame(last_BMP, &pool);
+                        spare_BMP = last_BMP;
+                    }
+                    //Now the current file becomes the last file 
+                    last_BMP = curr_BMP;
+                    curr_BMP = spare_BMP;
                 break;
             }
             file_count++;
@@ -1101,21 +4467,45 @@ int main(int argc, char *argv[])
         if (file_count == 1) {
             fprintf(stderr, "There was only one file specified, so no animation was possible.\n");
             free_files_charpp(cmd_file_data, num_lines_in_file);
-            free_BMP_arr(file_count, BMP_handler);
+            encode_report_free(&report);
+            free_BMP_arr(first_BMP, last_BMP, &pool);
+            encode_workspace_free(&workspace);
+            frame_pool_free(&pool);
+            arf_palette_free(&palette);
+            if (options.dedup)
+                arf_dedup_free(&dedup);
             return 1;
         }
         
         //Creates the final looping animation based off of the first and last BMPs
-        BMP_handler[first_BMP_attr].animate_dir = draw_dir2num(cmd_file_data[file_count*2-1]);
-        files2arf(&BMP_handler[last_BMP_attr], &BMP_handler[first_BMP_attr], argv[output_dir_argv], file_count, encode_type);
+        first_BMP->animate_dir = draw_dir2num(cmd_file_data[file_count*2-1]);
+        if (!compress_pair(last_BMP, first_BMP, pos_argv[output_dir_argv], file_count, &options, &workspace, &dedup, &cached_pairs))
+            pairs_encoded = false;
+        if (options.tolerance > 0)
+            fprintf(stdout, "Tolerance: %d changed pixels were within %d of the shown color and left alone\n", pixels_snapped, options.tolerance);
+        if (options.cache_dir)
+            fprintf(stdout, "Cache: %d of %d pairs reused from %s\n", cached_pairs, file_count, options.cache_dir);
+        //without manifest.txt the player can't find the shared .arf files
+        if (pairs_encoded && options.dedup && !arf_dedup_write_manifest(&dedup))
+            pairs_encoded = false;
+        bool packed = pairs_encoded && (!options.pack || pack_animation(cmd_file_data, num_lines_in_file, pos_argv[output_dir_argv], &options));
+        if (options.report) {
+            if (packed && !encode_report_write(&report, &options))
+                packed = false;
+            encode_report_free(&report);
+        }
         //Free up the final values
-        free(BMP_handler[first_BMP_attr].BMP_pixel_array);
-        free(BMP_handler[last_BMP_attr].BMP_pixel_array);
-        free(BMP_handler[first_BMP_attr].BMP_header);
-        free(BMP_handler[last_BMP_attr].BMP_header);
+        free_BMP_arr(first_BMP, last_BMP, &pool);
+        encode_workspace_free(&workspace);
+        frame_pool_free(&pool);
+        arf_palette_free(&palette);
+        if (options.dedup)
+            arf_dedup_free(&dedup);
         //Free up the setup file read in 
         free_files_charpp(cmd_file_data, num_lines_in_file);
+        if (!packed)
+            return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -472,6 +472,58 @@ void LCDWIKI_KBV::Push_Any_Color(uint8_t * block, int16_t n, bool first, uint8_t
     CS_IDLE;
 }
 
+//push a pre-rendered bus stream (encode 6 of animate_compress). Each tag word is followed by what it needs:
+//0x8000|cmd is a command on its own, 0xC000|cmd is a command and then two words sent as its 4 parameter bytes
+//(the start and end of an address window), 0x4000|n sends the next word n times and n (under 0x4000) sends 
+//the next n words. A tag can be split across blocks, stream_state (2 words, start them at 0) carries it over
+void LCDWIKI_KBV::Push_Bus_Stream(uint16_t * block, int16_t n, uint16_t * stream_state)
+{
+	uint16_t tag = stream_state[0];
+	uint16_t left = stream_state[1];
+	uint16_t word, count;
+	CS_ACTIVE;
+	while (n-- > 0) 
+	{
+		word = *block++;
+		if (left == 0) 
+		{
+			tag = word;
+			if (tag & 0x8000) 
+			{
+				writeCmd16(tag & 0xFF);
+				left = (tag & 0x4000) ? 2 : 0;
+			}
+			else 
+			{
+				left = (tag & 0x4000) ? 1 : tag;
+			}
+		}
+		else if (tag & 0x8000) 
+		{
+			writeData8(word >> 8);
+			writeData8(word & 0xFF);
+			left--;
+		}
+		else if (tag & 0x4000) 
+		{
+			count = tag & 0x3FFF;
+			while (count-- > 0) 
+			{
+				writeData16(word);
+			}
+			left = 0;
+		}
+		else 
+		{
+			writeData16(word);
+			left--;
+		}
+	}
+	CS_IDLE;
+	stream_state[0] = tag;
+	stream_state[1] = left;
+}
+
 //Pass 8-bit (each) R,G,B, get back 16-bit packed color
 uint16_t LCDWIKI_KBV::Color_To_565(uint8_t r, uint8_t g, uint8_t b)
 {
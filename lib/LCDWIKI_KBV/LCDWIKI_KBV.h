@@ -83,6 +83,7 @@ class LCDWIKI_KBV:public LCDWIKI_GUI
 	void Set_Addr_Window(int16_t x1, int16_t y1, int16_t x2, int16_t y2);
 	void Push_Any_Color(uint16_t * block, int16_t n, bool first, uint8_t flags);
 	void Push_Any_Color(uint8_t * block, int16_t n, bool first, uint8_t flags);
+	void Push_Bus_Stream(uint16_t * block, int16_t n, uint16_t * stream_state);
     void Vert_Scroll(int16_t top, int16_t scrollines, int16_t offset);
 	int16_t Get_Height(void) const;
   	int16_t Get_Width(void) const;
@@ -20,9 +20,9 @@
 //MODIFY HERE IF DIFFERENT PINOUT
 LCDWIKI_KBV my_lcd(ILI9486,40,38,39,-1,41); //model,cs,cd,wr,rd,reset 
 
-extern uint32_t bmp_offset = 0;
-extern uint16_t s_width = my_lcd.Get_Display_Width();  
-extern uint16_t s_height= my_lcd.Get_Display_Height();
+uint32_t bmp_offset = 0;
+uint16_t s_width = my_lcd.Get_Display_Width();  
+uint16_t s_height= my_lcd.Get_Display_Height();
 enum draw_direction {up2down, down2up, left2right, right2left};
 
 #define PIXEL_NUMBER  (s_width/4)
@@ -198,6 +198,62 @@ void init_SD_display() {
     }
 }
 
+#define ARF_PALETTE_FLAG 0x80 //the colors are indices into the animation's palette.pal
+#define ARF_NIBBLE_FLAG 0x40  //the pixel arrays hold 4 bit indices, two to a byte
+#define ARF_SECTOR_FLAG 0x20  //the ops are laid out in 512 byte SD card sectors (encodes 1 and 2)
+#define ARF_ENCODE_MASK 0x0F
+#define ARF_SECTOR_SIZE 512
+#define ARF_SECTOR_HEADER 12 //the usual 8 bytes, then the number of sectors and 2 spare bytes
+uint16_t* arf_palette = NULL;
+
+//loads the palette.pal the compressor writes with --palette into SRAM. Call it before playing the animation's .arf files
+bool load_arf_palette(const char* palette_file) {
+    File palette_fp = SD.open(palette_file);
+    if (!palette_fp) {
+      Serial.println("Failed to open palette");
+      return false;
+    }
+    if (read_16(palette_fp) != 0x4C50) { //0x4C50 is "PL"
+      Serial.println("Non valid palette file.");
+      palette_fp.close();
+      return false;
+    }
+    uint16_t num_colors = read_16(palette_fp);
+    read_16(palette_fp); //index bits and a spare byte, the .arf files say how they're packed
+    free(arf_palette);
+    arf_palette = (uint16_t*)malloc(sizeof(uint16_t)*num_colors);
+    palette_fp.read(arf_palette, sizeof(uint16_t)*num_colors);
+    palette_fp.close();
+    return true;
+}
+
+//reads one color, which is a 1 byte index when the .arf uses the palette
+uint16_t read_arf_color(File arf_file, char color_flags) {
+    if (color_flags & ARF_PALETTE_FLAG)
+      return arf_palette[(uint8_t)arf_file.read()];
+    return read_16(arf_file);
+}
+
+//reads num_pixels colors of a pixel array into pixel_buff. Palette indices are read into the front of the buffer 
+//and expanded from the back so the colors don't write over indices that haven't been used yet
+void read_arf_pixels(File arf_file, uint16_t* pixel_buff, int16_t num_pixels, char color_flags) {
+    if (!(color_flags & ARF_PALETTE_FLAG)) {
+      arf_file.read(pixel_buff, sizeof(uint16_t)*num_pixels);
+      return;
+    }
+    uint8_t* index_buff = (uint8_t*)pixel_buff;
+    if (color_flags & ARF_NIBBLE_FLAG) {
+      arf_file.read(index_buff, (num_pixels+1)/2);
+      for (int16_t i = num_pixels-1; i >= 0; i--)
+        pixel_buff[i] = arf_palette[i % 2 == 0 ? index_buff[i/2] >> 4 : index_buff[i/2] & 0x0F];
+    }
+    else {
+      arf_file.read(index_buff, num_pixels);
+      for (int16_t i = num_pixels-1; i >= 0; i--)
+        pixel_buff[i] = arf_palette[index_buff[i]];
+    }
+}
+
 bool verify_arf(File arf_fp, uint32_t* arf_num_entries, char* draw_dir, char* encode_type) {
   if (read_16(arf_fp) != 0x5241) { //0x5241 is "AR"
     Serial.println("Non valid ARF file. Doesn't have correct header format.");
@@ -211,72 +267,488 @@ bool verify_arf(File arf_fp, uint32_t* arf_num_entries, char* draw_dir, char* en
   
 }
 
-void print_arf_dir_encode1(File arf_file, uint32_t arf_num_entries, char draw_dir) {
+//every entry has its own x and y, so draw_dir isn't used
+void print_arf_dir_encode1(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags) {
+    (void)draw_dir;
     int16_t* entries_buff = (int16_t*)malloc(sizeof(int16_t)*3); //3 because 2-byte xpos, 2-byte y-pos, 2-byte rgb
     //loop through all of the entries, reading them in and printing their values to the screen
     int16_t last_color = 0x00; 
     my_lcd.Set_Draw_color(last_color);
     for (uint32_t i = 0; i < arf_num_entries; i++) {
-      arf_file.read(entries_buff, sizeof(int16_t)*3); 
+      if (color_flags & ARF_PALETTE_FLAG) {
+        arf_file.read(entries_buff, sizeof(int16_t)*2); 
+        entries_buff[2] = read_arf_color(arf_file, color_flags);
+      }
+      else
+        arf_file.read(entries_buff, sizeof(int16_t)*3); 
       my_lcd.Draw_Pixe(entries_buff[0], entries_buff[1], entries_buff[2]);
     }
     free(entries_buff);
 }
 
-void print_arf_dir_encode2(File arf_file, uint32_t arf_num_entries, char draw_dir) {
-    int16_t* entries_buff = (int16_t*)malloc(sizeof(int16_t)*3); //3 because 2-byte xpos, 2-byte y-pos, 2-byte rgb
+void print_arf_dir_encode2(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags) {
+    int16_t* entries_buff = (int16_t*)malloc(sizeof(int16_t)*3); //3 because 2-byte color, 2-byte start, 2-byte end
     int16_t curr_row;
     int16_t curr_entries_on_row; 
+    int16_t last_color = 0x00; 
+    my_lcd.Set_Draw_color(last_color);
     if (draw_dir < 2) {
       //loop through all of the entries, reading them in and printing their values to the screen
-      int16_t last_color = 0x00; 
-      my_lcd.Set_Draw_color(last_color);
       for (uint32_t i = 0; i < arf_num_entries; i++) {
         arf_file.read(&curr_row, sizeof(int16_t)); 
         arf_file.read(&curr_entries_on_row, sizeof(int16_t)); 
         for (int row_entry = 0; row_entry < curr_entries_on_row; row_entry++) {
-            arf_file.read(entries_buff, sizeof(int16_t)*3); 
+            entries_buff[0] = read_arf_color(arf_file, color_flags);
+            arf_file.read(entries_buff+1, sizeof(int16_t)*2); 
             my_lcd.Set_Draw_color(entries_buff[0]);
             my_lcd.Draw_Fast_HLine(entries_buff[1], curr_row, entries_buff[2]-entries_buff[1]+1);
         }
       }
-      free(entries_buff);
     }
+    else {
+      //left and right are stored by columns: the header is the x location and the entries are y ranges
+      int16_t curr_col;
+      int16_t curr_entries_on_col; 
+      for (uint32_t i = 0; i < arf_num_entries; i++) {
+        arf_file.read(&curr_col, sizeof(int16_t)); 
+        arf_file.read(&curr_entries_on_col, sizeof(int16_t)); 
+        for (int col_entry = 0; col_entry < curr_entries_on_col; col_entry++) {
+            entries_buff[0] = read_arf_color(arf_file, color_flags);
+            arf_file.read(entries_buff+1, sizeof(int16_t)*2); 
+            my_lcd.Set_Draw_color(entries_buff[0]);
+            my_lcd.Draw_Fast_VLine(curr_col, entries_buff[1], entries_buff[2]-entries_buff[1]+1);
+        }
+      }
+    }
+    free(entries_buff);
 }
 
-//.arf stands for animation rendering file
-void display_arf(const char* file_name) {
-    File arf_file; 
+//rectangles are drawn the same whatever the direction, so draw_dir isn't used
+void print_arf_dir_encode3(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags) {
+    (void)draw_dir;
+    int16_t rect[4]; //x0, y0, x1, y1 (inclusive)
+    uint16_t* pixel_buff = (uint16_t*)malloc(sizeof(uint16_t)*PIXEL_NUMBER);
+    //each entry is a rectangle: set the address window once, then stream its pixels straight to the screen
+    for (uint32_t i = 0; i < arf_num_entries; i++) {
+      arf_file.read(rect, sizeof(rect));
+      my_lcd.Set_Addr_Window(rect[0], rect[1], rect[2], rect[3]);
+      uint32_t pixels_left = (uint32_t)(rect[2]-rect[0]+1)*(rect[3]-rect[1]+1);
+      bool first = true;
+      while (pixels_left > 0) {
+        int16_t num_pixels = pixels_left < PIXEL_NUMBER ? pixels_left : PIXEL_NUMBER;
+        read_arf_pixels(arf_file, pixel_buff, num_pixels, color_flags);
+        my_lcd.Push_Any_Color(pixel_buff, num_pixels, first, 0);
+        first = false;
+        pixels_left -= num_pixels;
+      }
+    }
+    free(pixel_buff);
+}
+
+void print_arf_dir_encode4(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags) {
+    int16_t line_header[2]; //line location, number of ops
+    int16_t op[2]; //start location, length (negative for pushed pixels)
+    uint16_t* pixel_buff = (uint16_t*)malloc(sizeof(uint16_t)*PIXEL_NUMBER);
+    for (uint32_t i = 0; i < arf_num_entries; i++) {
+      arf_file.read(line_header, sizeof(line_header));
+      for (int op_num = 0; op_num < line_header[1]; op_num++) {
+        arf_file.read(op, sizeof(op));
+        if (op[1] > 0) {
+          //solid run of one color
+          uint16_t color = read_arf_color(arf_file, color_flags);
+          if (draw_dir < 2)
+            my_lcd.Fill_Rect(op[0], line_header[0], op[1], 1, color);
+          else
+            my_lcd.Fill_Rect(line_header[0], op[0], 1, op[1], color);
+        }
+        else {
+          //literal run: open a one line window and push the colors that follow
+          int16_t pixels_left = -op[1];
+          if (draw_dir < 2)
+            my_lcd.Set_Addr_Window(op[0], line_header[0], op[0]+pixels_left-1, line_header[0]);
+          else
+            my_lcd.Set_Addr_Window(line_header[0], op[0], line_header[0], op[0]+pixels_left-1);
+          bool first = true;
+          while (pixels_left > 0) {
+            int16_t num_pixels = pixels_left < PIXEL_NUMBER ? pixels_left : PIXEL_NUMBER;
+            read_arf_pixels(arf_file, pixel_buff, num_pixels, color_flags);
+            my_lcd.Push_Any_Color(pixel_buff, num_pixels, first, 0);
+            first = false;
+            pixels_left -= num_pixels;
+          }
+        }
+      }
+    }
+    free(pixel_buff);
+}
+
+//encode 6 is the display bus writes themselves, the compressor already decided them. The words are read in 
+//chunks and handed straight to the library, which carries a tag that's split between chunks over in stream_state.
+//The stream already has its own address windows and direct colors, so draw_dir and color_flags aren't used
+void print_arf_dir_encode6(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags) {
+    (void)draw_dir;
+    (void)color_flags;
+    uint16_t* stream_buff = (uint16_t*)malloc(sizeof(uint16_t)*PIXEL_NUMBER);
+    uint16_t stream_state[2] = {0, 0};
+    uint32_t words_left = arf_num_entries;
+    while (words_left > 0) {
+      int16_t num_words = words_left < PIXEL_NUMBER ? words_left : PIXEL_NUMBER;
+      arf_file.read(stream_buff, sizeof(uint16_t)*num_words);
+      my_lcd.Push_Bus_Stream(stream_buff, num_words, stream_state);
+      words_left -= num_words;
+    }
+    free(stream_buff);
+}
+
+File sprite_file; //the sprites.spr encode 5 draws from, kept open while the animation plays
+
+//opens the sprites.spr the compressor writes for encode 5. Call it before playing the animation's .arf files
+bool open_sprite_archive(const char* sprite_file_name) {
+    if (sprite_file)
+      sprite_file.close();
+    sprite_file = SD.open(sprite_file_name);
+    if (!sprite_file) {
+      Serial.println("Failed to open sprite archive");
+      return false;
+    }
+    if (read_16(sprite_file) != 0x5053) { //0x5053 is "SP"
+      Serial.println("Non valid sprite archive.");
+      sprite_file.close();
+      return false;
+    }
+    return true;
+}
+
+//draws width x height pixels of a sprite at (x, y). The sprite's rows are sprite_width long and the blit 
+//starts (sprite_x, sprite_y) into it, so the background (sprite 0) can be restored a piece at a time
+void blit_sprite(uint32_t data_offset, int16_t sprite_width, int16_t sprite_x, int16_t sprite_y, int16_t x, int16_t y, int16_t width, int16_t height, uint16_t* pixel_buff) {
+    my_lcd.Set_Addr_Window(x, y, x+width-1, y+height-1);
+    bool first = true;
+    for (int16_t row = 0; row < height; row++) {
+      sprite_file.seek(data_offset + sizeof(uint16_t)*((uint32_t)(sprite_y+row)*sprite_width + sprite_x));
+      int16_t pixels_left = width;
+      while (pixels_left > 0) {
+        int16_t num_pixels = pixels_left < PIXEL_NUMBER ? pixels_left : PIXEL_NUMBER;
+        sprite_file.read(pixel_buff, sizeof(uint16_t)*num_pixels);
+        my_lcd.Push_Any_Color(pixel_buff, num_pixels, first, 0);
+        first = false;
+        pixels_left -= num_pixels;
+      }
+    }
+}
+
+//The blits go wherever the ops say and the sprites are direct colors (the compressor won't use --palette with 
+//encode 5), so draw_dir and color_flags aren't used
+void print_arf_dir_encode5(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags) {
+    (void)draw_dir;
+    (void)color_flags;
+    int16_t op[3]; //sprite number, x location, y location
+    int16_t restore_size[2]; //width, height of the background to restore when the sprite number is 0
+    uint32_t data_offset;
+    int16_t sprite_size[2];
+    uint16_t* pixel_buff = (uint16_t*)malloc(sizeof(uint16_t)*PIXEL_NUMBER);
+    for (uint32_t i = 0; i < arf_num_entries; i++) {
+      arf_file.read(op, sizeof(op));
+      //the table entry: [data offset, width, height] 8 bytes each after the 8 byte header
+      sprite_file.seek(8 + 8*(uint32_t)op[0]);
+      sprite_file.read(&data_offset, sizeof(uint32_t));
+      sprite_file.read(sprite_size, sizeof(sprite_size));
+      if (op[0] == 0) {
+        arf_file.read(restore_size, sizeof(restore_size));
+        blit_sprite(data_offset, sprite_size[0], op[1], op[2], op[1], op[2], restore_size[0], restore_size[1], pixel_buff);
+      }
+      else
+        blit_sprite(data_offset, sprite_size[0], 0, 0, op[1], op[2], sprite_size[0], sprite_size[1], pixel_buff);
+    }
+    free(pixel_buff);
+}
+
+//reads a sector laid out .arf a whole sector at a time
+struct arf_sector_reader {
+    File arf_file;
+    uint8_t* sector_buff;
+    uint16_t sector_pos;
+};
+
+//returns where the next op_size byte op is in the sector buffer. An op never crosses a sector: one that doesn't 
+//fit in the rest of the sector is at the start of the next one, so that sector gets read in
+uint8_t* next_sector_op(struct arf_sector_reader* reader, uint16_t op_size) {
+    if (reader->sector_pos + op_size > ARF_SECTOR_SIZE) {
+      reader->arf_file.read(reader->sector_buff, ARF_SECTOR_SIZE);
+      reader->sector_pos = 0;
+    }
+    uint8_t* op = reader->sector_buff + reader->sector_pos;
+    reader->sector_pos += op_size;
+    return op;
+}
+
+//reads a color out of an op, which is a 1 byte index when the .arf uses the palette
+uint16_t sector_op_color(const uint8_t* op_color, char color_flags) {
+    if (color_flags & ARF_PALETTE_FLAG)
+      return arf_palette[*op_color];
+    uint16_t color;
+    memcpy(&color, op_color, sizeof(uint16_t));
+    return color;
+}
+
+//draws an encode 1 or 2 .arf that's laid out in sectors (--sector-align). The file is read a whole sector at a time 
+//in place of the 2 byte reads print_arf_dir_encode1 and print_arf_dir_encode2 make
+void print_arf_sectors(File arf_file, uint32_t arf_num_entries, char draw_dir, char encode_type, char color_flags) {
+    struct arf_sector_reader reader;
+    reader.arf_file = arf_file;
+    reader.sector_buff = (uint8_t*)malloc(ARF_SECTOR_SIZE);
+    //the header has been read already, the rest of the first sector goes in after where it would be
+    arf_file.read(reader.sector_buff+8, ARF_SECTOR_SIZE-8);
+    reader.sector_pos = ARF_SECTOR_HEADER;
+    uint8_t color_size = (color_flags & ARF_PALETTE_FLAG) ? 1 : 2;
+    int16_t op_pos[2];
+    for (uint32_t i = 0; i < arf_num_entries; i++) {
+      if (encode_type == 1) {
+        //[x, y, color]
+        uint8_t* op = next_sector_op(&reader, sizeof(op_pos)+color_size);
+        memcpy(op_pos, op, sizeof(op_pos));
+        my_lcd.Draw_Pixe(op_pos[0], op_pos[1], sector_op_color(op+sizeof(op_pos), color_flags));
+        continue;
+      }
+      //[line, count] then count [color, start, end]
+      int16_t line_header[2];
+      memcpy(line_header, next_sector_op(&reader, sizeof(line_header)), sizeof(line_header));
+      for (int line_entry = 0; line_entry < line_header[1]; line_entry++) {
+        uint8_t* op = next_sector_op(&reader, color_size+sizeof(op_pos));
+        memcpy(op_pos, op+color_size, sizeof(op_pos));
+        my_lcd.Set_Draw_color(sector_op_color(op, color_flags));
+        if (draw_dir < 2)
+          my_lcd.Draw_Fast_HLine(op_pos[0], line_header[0], op_pos[1]-op_pos[0]+1);
+        else
+          my_lcd.Draw_Fast_VLine(line_header[0], op_pos[0], op_pos[1]-op_pos[0]+1);
+      }
+    }
+    free(reader.sector_buff);
+}
+
+//draws the .arf that starts at arf_file's position (a .arf file or one inside an animation.akf)
+bool draw_arf(File arf_file) {
     uint32_t arf_num_entries; 
     char draw_dir;
     char encode_type;
-    unsigned long start = millis();
-    arf_file = SD.open(file_name);
-    if (!arf_file) {
-      Serial.println("Failed to open ARF");
-      return;
-    }
-
     if (!verify_arf(arf_file, &arf_num_entries, &draw_dir, &encode_type)) {
       Serial.println("Failed to verify ARF file");
-      arf_file.close(); 
-      return;
+      return false;
     }
 
-    switch(encode_type) {
+    //the top bits say how the colors are stored, the rest is the encoding type
+    char encode_flags = encode_type & ~ARF_ENCODE_MASK;
+    if ((encode_flags & ARF_PALETTE_FLAG) && arf_palette == NULL) {
+      Serial.println("ARF uses a palette, call load_arf_palette first");
+      return false;
+    }
+    if (encode_flags & ARF_SECTOR_FLAG) {
+      print_arf_sectors(arf_file, arf_num_entries, draw_dir, encode_type & ARF_ENCODE_MASK, encode_flags);
+      return true;
+    }
+    switch(encode_type & ARF_ENCODE_MASK) {
       case 1: //when the encoding type is xyrgb
-        print_arf_dir_encode1(arf_file, arf_num_entries, draw_dir);
+        print_arf_dir_encode1(arf_file, arf_num_entries, draw_dir, encode_flags);
       break;
       case 2:
-        print_arf_dir_encode2(arf_file, arf_num_entries, draw_dir);
+        print_arf_dir_encode2(arf_file, arf_num_entries, draw_dir, encode_flags);
+      break;
+      case 3:
+        print_arf_dir_encode3(arf_file, arf_num_entries, draw_dir, encode_flags);
+      break;
+      case 4:
+        print_arf_dir_encode4(arf_file, arf_num_entries, draw_dir, encode_flags);
+      break;
+      case 5:
+        if (!sprite_file) {
+          Serial.println("ARF uses sprites, call open_sprite_archive first");
+          return false;
+        }
+        print_arf_dir_encode5(arf_file, arf_num_entries, draw_dir, encode_flags);
+      break;
+      case 6:
+        print_arf_dir_encode6(arf_file, arf_num_entries, draw_dir, encode_flags);
       break;
     }
+    return true;
+}
+
+//.arf stands for animation rendering file
+void display_arf(const char* file_name) {
+    File arf_file; 
+    unsigned long start = millis();
+    arf_file = SD.open(file_name);
+    if (!arf_file) {
+      Serial.println("Failed to open ARF");
+      return;
+    }
+
+    draw_arf(arf_file);
 
     sprintf(sbuf,"Draw ARF Time: %lu", millis()-start);
     Serial.println(sbuf);
     arf_file.close(); 
 }
 
+File container_file; //the animation.akf from the compressor's --keyframes, kept open while the animation plays
+uint16_t container_num_frames = 0;
+uint16_t container_keyframe_interval = 0;
+int32_t container_frame = -1; //the frame on the screen, -1 when it isn't one of the container's
+
+//opens the animation.akf the compressor writes with --keyframes. Nothing is drawn until draw_container_frame
+bool open_arf_container(const char* container_file_name) {
+    if (container_file)
+      container_file.close();
+    container_frame = -1;
+    container_file = SD.open(container_file_name);
+    if (!container_file) {
+      Serial.println("Failed to open container");
+      return false;
+    }
+    if (read_16(container_file) != 0x4B41) { //0x4B41 is "AK"
+      Serial.println("Non valid container file.");
+      container_file.close();
+      return false;
+    }
+    container_num_frames = read_16(container_file);
+    container_keyframe_interval = read_16(container_file);
+    return true;
+}
+
+//draws the keyframe (keyframe true) or the delta of a frame, using the container's index
+bool draw_container_arf(uint16_t frame, bool keyframe) {
+    uint32_t arf_offset;
+    container_file.seek(8 + 8*(uint32_t)frame + (keyframe ? 0 : 4));
+    container_file.read(&arf_offset, sizeof(uint32_t));
+    if (arf_offset == 0) {
+      Serial.println("Container has no keyframe there");
+      return false;
+    }
+    container_file.seek(arf_offset);
+    return draw_arf(container_file);
+}
+
+//puts frame on the screen. The next frame is just its delta, any other frame is drawn from the keyframe before it 
+//(or from the frame on the screen, when that's closer) so it never takes more than keyframe interval - 1 deltas
+bool draw_container_frame(uint16_t frame) {
+    if (!container_file || frame >= container_num_frames) {
+      Serial.println("Frame isn't in the container");
+      return false;
+    }
+    unsigned long start = millis();
+    uint16_t keyframe = frame - frame % container_keyframe_interval;
+    uint16_t next_frame = (container_frame + 1) % container_num_frames;
+    if (container_frame >= 0 && frame == next_frame) {
+      if (!draw_container_arf(frame, false)) {
+        container_frame = -1; //part of it might have been drawn
+        return false;
+      }
+    }
+    else {
+      if (container_frame < keyframe || container_frame > frame) {
+        if (!draw_container_arf(keyframe, true)) {
+          container_frame = -1;
+          return false;
+        }
+        container_frame = keyframe;
+      }
+      for (uint16_t delta = container_frame+1; delta <= frame; delta++) {
+        if (!draw_container_arf(delta, false)) {
+          container_frame = -1;
+          return false;
+        }
+      }
+    }
+    container_frame = frame;
+    sprintf(sbuf,"Draw Frame %u Time: %lu", frame, millis()-start);
+    Serial.println(sbuf);
+    return true;
+}
+
+File graph_file; //the animation.agr from the compressor's --graph, kept open while the character is on the screen
+uint16_t graph_num_states = 0;
+uint16_t graph_num_edges = 0;
+int32_t graph_state = -1; //the state on the screen, -1 when it isn't one of the graph's
+
+//opens the animation.agr the compressor writes with --graph. Nothing is drawn until draw_graph_state or transition_to_state
+bool open_arf_graph(const char* graph_file_name) {
+    if (graph_file)
+      graph_file.close();
+    graph_state = -1;
+    graph_file = SD.open(graph_file_name);
+    if (!graph_file) {
+      Serial.println("Failed to open graph");
+      return false;
+    }
+    if (read_16(graph_file) != 0x4741) { //0x4741 is "AG"
+      Serial.println("Non valid graph file.");
+      graph_file.close();
+      return false;
+    }
+    graph_num_states = read_16(graph_file);
+    graph_num_edges = read_16(graph_file);
+    return true;
+}
+
+//draws a state's keyframe, whatever is on the screen
+bool draw_graph_state(uint16_t state) {
+    if (!graph_file || state >= graph_num_states) {
+      Serial.println("State isn't in the graph");
+      return false;
+    }
+    graph_file.seek(8 + 8*(uint32_t)state); //the state's entry: [keyframe offset, first edge, number of edges]
+    uint32_t keyframe_offset = read_32(graph_file);
+    graph_file.seek(keyframe_offset);
+    if (!draw_arf(graph_file)) {
+      graph_state = -1; //part of it might have been drawn
+      return false;
+    }
+    graph_state = state;
+    return true;
+}
+
+//goes from the state on the screen to state with the edge's delta. When there's no edge between them (or the
+//screen isn't showing a state yet) it falls back to state's keyframe
+bool transition_to_state(uint16_t state) {
+    if (!graph_file || state >= graph_num_states) {
+      Serial.println("State isn't in the graph");
+      return false;
+    }
+    if (graph_state == state)
+      return true;
+    unsigned long start = millis();
+    uint32_t delta_offset = 0;
+    if (graph_state >= 0) {
+      graph_file.seek(8 + 8*(uint32_t)graph_state + 4);
+      uint16_t first_edge = read_16(graph_file);
+      uint16_t num_edges = read_16(graph_file);
+      //the edges leaving a state are next to each other: [to, spare, delta offset]
+      graph_file.seek(8 + 8*(uint32_t)graph_num_states + 8*(uint32_t)first_edge);
+      for (uint16_t edge = 0; edge < num_edges && delta_offset == 0; edge++) {
+        uint16_t to = read_16(graph_file);
+        read_16(graph_file);
+        uint32_t edge_offset = read_32(graph_file);
+        if (to == state)
+          delta_offset = edge_offset;
+      }
+    }
+    if (delta_offset == 0) {
+      if (!draw_graph_state(state))
+        return false;
+    }
+    else {
+      graph_file.seek(delta_offset);
+      if (!draw_arf(graph_file)) {
+        graph_state = -1;
+        return false;
+      }
+      graph_state = state;
+    }
+    sprintf(sbuf,"Transition to State %u Time: %lu", state, millis()-start);
+    Serial.println(sbuf);
+    return true;
+}
+
 //assumes format of .bmp, then all .arf after
 bool draw_animation(const char ** animation_files, int num_files, bool* already_blinked) {
   if (!*already_blinked) {
@@ -288,3 +760,93 @@ bool draw_animation(const char ** animation_files, int num_files, bool* already_
   }
   return true;
 }
+
+//Plays every .arf listed in a manifest made by the compressor's --dedup option. The manifest has one .arf name per 
+//line, relative to the manifest's folder, and the same .arf can show up more than once
+bool draw_animation_manifest(const char* bmp_file, const char* manifest_file, bool* already_blinked) {
+  File manifest = SD.open(manifest_file);
+  if (!manifest) {
+    Serial.println("Failed to open manifest");
+    return false;
+  }
+  if (!*already_blinked) {
+    display_bmp(bmp_file, down2up); 
+    *already_blinked = true;
+  }
+  //the names get put after the manifest's folder
+  char arf_path[64];
+  const char* last_slash = strrchr(manifest_file, '/');
+  int dir_len = last_slash ? last_slash-manifest_file+1 : 0;
+  if (dir_len > (int)sizeof(arf_path)-14) { //room for an 8.3 name
+    Serial.println("Manifest path is too long");
+    manifest.close();
+    return false;
+  }
+  memcpy(arf_path, manifest_file, dir_len);
+  while (manifest.available()) {
+    int name_len = manifest.readBytesUntil('\n', arf_path+dir_len, sizeof(arf_path)-dir_len-1);
+    //manifests written on windows end their lines with \r\n
+    if (name_len > 0 && arf_path[dir_len+name_len-1] == '\r')
+      name_len--;
+    if (name_len == 0)
+      continue;
+    arf_path[dir_len+name_len] = '\0';
+    display_arf(arf_path);
+  }
+  manifest.close();
+  return true;
+}
+
+File pack_file; //the animation.pak from the compressor's --pack, kept open while the animation plays
+uint16_t pack_num_frames = 0;
+
+//opens the animation.pak the compressor writes with --pack. The frames are drawn with draw_pack_frame
+bool open_arf_pack(const char* pack_file_name) {
+  if (pack_file)
+    pack_file.close();
+  pack_num_frames = 0;
+  pack_file = SD.open(pack_file_name);
+  if (!pack_file) {
+    Serial.println("Failed to open pack");
+    return false;
+  }
+  if (read_16(pack_file) != 0x4B50) { //0x4B50 is "PK"
+    Serial.println("Non valid pack file.");
+    pack_file.close();
+    return false;
+  }
+  pack_num_frames = read_16(pack_file);
+  return true;
+}
+
+//draws frame (the .arf of pair frame) out of the open pack. It only seeks, so there's no directory lookup per frame
+bool draw_pack_frame(uint16_t frame) {
+  if (!pack_file || frame >= pack_num_frames) {
+    Serial.println("Frame isn't in the pack");
+    return false;
+  }
+  unsigned long start = millis();
+  uint32_t arf_offset;
+  pack_file.seek(8 + 8*(uint32_t)frame); //the table entry: [offset, length]
+  pack_file.read(&arf_offset, sizeof(uint32_t));
+  pack_file.seek(arf_offset);
+  bool drawn = draw_arf(pack_file);
+  sprintf(sbuf,"Draw ARF Time: %lu", millis()-start);
+  Serial.println(sbuf);
+  return drawn;
+}
+
+//Plays every frame of an animation.pak, after the .bmp. The pack stays open to play it again
+bool draw_animation_pack(const char* bmp_file, const char* pack_file_name, bool* already_blinked) {
+  if (!open_arf_pack(pack_file_name))
+    return false;
+  if (!*already_blinked) {
+    display_bmp(bmp_file, down2up); 
+    *already_blinked = true;
+  }
+  for (uint16_t frame = 0; frame < pack_num_frames; frame++) {
+    if (!draw_pack_frame(frame))
+      return false;
+  }
+  return true;
+}
@@ -30,14 +30,71 @@ void display_bmp(const char* file_name, enum draw_direction draw_dir);
 
 void init_SD_display();
 
+//loads the palette.pal the compressor writes with --palette into SRAM. Call it before playing the animation's .arf files
+bool load_arf_palette(const char* palette_file);
+
+uint16_t read_arf_color(File arf_file, char color_flags);
+
+void read_arf_pixels(File arf_file, uint16_t* pixel_buff, int16_t num_pixels, char color_flags);
+
 bool verify_arf(File arf_fp, uint32_t* arf_num_entries, char* draw_dir, char* encode_type);
 
-void print_arf_dir_encode1(File arf_file, uint32_t arf_num_entries, char draw_dir);
+void print_arf_dir_encode1(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags);
+
+void print_arf_dir_encode2(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags);
+
+void print_arf_dir_encode3(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags);
+
+void print_arf_dir_encode4(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags);
+
+void print_arf_dir_encode6(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags);
+
+//opens the sprites.spr the compressor writes for encode 5. Call it before playing the animation's .arf files
+bool open_sprite_archive(const char* sprite_file_name);
+
+void blit_sprite(uint32_t data_offset, int16_t sprite_width, int16_t sprite_x, int16_t sprite_y, int16_t x, int16_t y, int16_t width, int16_t height, uint16_t* pixel_buff);
+
+void print_arf_dir_encode5(File arf_file, uint32_t arf_num_entries, char draw_dir, char color_flags);
+
+uint8_t* next_sector_op(struct arf_sector_reader* reader, uint16_t op_size);
+
+uint16_t sector_op_color(const uint8_t* op_color, char color_flags);
 
-void print_arf_dir_encode2(File arf_file, uint32_t arf_num_entries, char draw_dir);
+//draws an encode 1 or 2 .arf that's laid out in 512 byte sectors (the compressor's --sector-align)
+void print_arf_sectors(File arf_file, uint32_t arf_num_entries, char draw_dir, char encode_type, char color_flags);
+
+//draws the .arf that starts at arf_file's position (a .arf file or one inside an animation.akf)
+bool draw_arf(File arf_file);
 
 //.arf stands for animation rendering file
 void display_arf(const char* file_name);
 
+//opens the animation.akf the compressor writes with --keyframes. Nothing is drawn until draw_container_frame
+bool open_arf_container(const char* container_file_name);
+
+bool draw_container_arf(uint16_t frame, bool keyframe);
+
+//puts any frame of the container on the screen: the keyframe before it plus less than keyframe interval deltas
+bool draw_container_frame(uint16_t frame);
+
+//opens the animation.agr the compressor writes with --graph. Nothing is drawn until draw_graph_state or transition_to_state
+bool open_arf_graph(const char* graph_file_name);
+
+bool draw_graph_state(uint16_t state);
+
+//reacts to an event: goes from the state on the screen to state with one delta (or its keyframe when there's no edge)
+bool transition_to_state(uint16_t state);
+
 //assumes format of .bmp, then all .arf after
 bool draw_animation(const char ** animation_files, int num_files, bool* already_blinked);
+
+//plays the .arf files listed in a manifest from the compressor's --dedup option, after the .bmp
+bool draw_animation_manifest(const char* bmp_file, const char* manifest_file, bool* already_blinked);
+
+//opens the animation.pak the compressor writes with --pack. The frames are drawn with draw_pack_frame
+bool open_arf_pack(const char* pack_file_name);
+
+bool draw_pack_frame(uint16_t frame);
+
+//plays every frame of an animation.pak, after the .bmp
+bool draw_animation_pack(const char* bmp_file, const char* pack_file_name, bool* already_blinked);